@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// unit quad, also the texture coordinates
+layout(location = 0) in vec2 corners;
+// per instance: x, y, width and height
+layout(location = 3) in vec4 rect;
+layout(location = 4) in vec4 colors;
+
+layout(location = 0) out vec3 color;
+layout(location = 1) out vec2 texCoord;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    gl_Position = vec4(rect.xy + corners * rect.zw, 0.0, 1.0);
+    color = colors.rgb;
+    texCoord = corners;
+}
@@ -0,0 +1,345 @@
+#include "benchmarkrenderer.h"
+#include "vulkan/trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Renders a synthetic scene headless for a fixed number of frames and prints the results as JSON.
+// Needs no display, e.g. to run on the lavapipe software renderer:
+//   VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json myVulkanBenchmark --frames 500
+// Has to run from the build directory to find data/shaders, debug builds need the validation layers.
+// Use --output for clean JSON, the renderer may log to stdout.
+
+namespace
+{
+    struct Options
+    {
+        BenchmarkRenderer::Settings scene;
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        uint32_t frames = 1000;
+        uint32_t warmupFrames = 50;
+        std::string output;
+        std::string trace;
+        // counted from the first warmup frame, init and setup belong to frame 0
+        uint32_t traceFirstFrame = 0;
+        uint32_t traceFrameCount = 100;
+    };
+
+    void printUsage()
+    {
+        std::cout << "usage: myVulkanBenchmark [options]\n"
+            << "  --frames N         measured frames (1000)\n"
+            << "  --warmup N         frames rendered before measuring (50)\n"
+            << "  --width N          render target width (1280)\n"
+            << "  --height N         render target height (720)\n"
+            << "  --quads N          number of quads (10000)\n"
+            << "  --draws N          number of draw calls the quads are split into (1000)\n"
+            << "  --textures N       number of textures (16)\n"
+            << "  --texture-size N   width and height of every texture (256)\n"
+            << "  --direct-uploads N 0 stages all uploads, 1 writes buffers in host visible device local memory directly (1)\n"
+            << "  --dynamic-quads N  quads rewritten every frame through the frame arena, planar layout only (0)\n"
+            << "  --interleaved N    1 interleaves the vertex attributes into one binding (0)\n"
+            << "  --compact-vertices N 1 stores vertices as 16 bit normalized positions and texture coordinates and 8 bit colors (0)\n"
+            << "  --optimize-mesh N  1 reorders triangles and vertices with the mesh optimizer before uploading (0)\n"
+            << "  --instanced N      1 draws the quads as instances of one quad, 2 rewrites the instances every frame (0)\n"
+            << "  --indirect N       1 issues the draws from an indirect buffer, one call per texture with multi draw indirect (0)\n"
+            << "  --output FILE      write the JSON results to FILE instead of stdout\n"
+            << "  --trace FILE       write a trace of CPU zones and GPU scopes to FILE\n"
+            << "  --trace-first N    first traced frame, warmup frames included (0)\n"
+            << "  --trace-frames N   number of traced frames (100)" << std::endl;
+    }
+
+    bool parseOptions(int argc, char* argv[], Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            if (i + 1 >= argc)
+                return false;
+
+            const std::string value = argv[++i];
+            if (arg == "--output")
+            {
+                options.output = value;
+                continue;
+            }
+            if (arg == "--trace")
+            {
+                options.trace = value;
+                continue;
+            }
+
+            const uint32_t number = static_cast<uint32_t>(std::stoul(value));
+            if (arg == "--frames")
+                options.frames = number;
+            else if (arg == "--warmup")
+                options.warmupFrames = number;
+            else if (arg == "--width")
+                options.width = number;
+            else if (arg == "--height")
+                options.height = number;
+            else if (arg == "--quads")
+                options.scene.quadCount = number;
+            else if (arg == "--draws")
+                options.scene.drawCount = number;
+            else if (arg == "--textures")
+                options.scene.textureCount = number;
+            else if (arg == "--texture-size")
+                options.scene.textureSize = number;
+            else if (arg == "--direct-uploads")
+                options.scene.directUploads = number != 0;
+            else if (arg == "--dynamic-quads")
+                options.scene.dynamicQuadCount = number;
+            else if (arg == "--interleaved")
+                options.scene.vertexLayout = number != 0 ? VertexBuffer::Layout::Interleaved : VertexBuffer::Layout::Planar;
+            else if (arg == "--compact-vertices")
+                options.scene.compactVertices = number != 0;
+            else if (arg == "--optimize-mesh")
+                options.scene.optimizeMesh = number != 0;
+            else if (arg == "--indirect")
+                options.scene.indirect = number != 0;
+            else if (arg == "--instanced")
+                options.scene.instancing = number == 0 ? BenchmarkRenderer::Instancing::None : number == 1 ? BenchmarkRenderer::Instancing::Static : BenchmarkRenderer::Instancing::PerFrame;
+            else if (arg == "--trace-first")
+                options.traceFirstFrame = number;
+            else if (arg == "--trace-frames")
+                options.traceFrameCount = number;
+            else
+                return false;
+        }
+        return options.frames > 0;
+    }
+
+    // nearest rank percentile of sorted values
+    double percentile(const std::vector<double>& sorted, double p)
+    {
+        const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+        return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+    }
+
+    void writeStatistics(std::ostream& out, std::vector<double> values)
+    {
+        if (values.empty())
+        {
+            out << "null";
+            return;
+        }
+
+        std::sort(values.begin(), values.end());
+        const double mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+
+        out << "{ \"samples\": " << values.size()
+            << ", \"mean\": " << mean
+            << ", \"min\": " << values.front()
+            << ", \"p50\": " << percentile(values, 50.0)
+            << ", \"p90\": " << percentile(values, 90.0)
+            << ", \"p99\": " << percentile(values, 99.0)
+            << ", \"max\": " << values.back() << " }";
+    }
+
+    const char* toString(BenchmarkRenderer::Instancing instancing)
+    {
+        switch (instancing)
+        {
+        case BenchmarkRenderer::Instancing::None: return "none";
+        case BenchmarkRenderer::Instancing::Static: return "static";
+        case BenchmarkRenderer::Instancing::PerFrame: return "per_frame";
+        }
+        return "unknown";
+    }
+
+    void writeMeshStatistics(std::ostream& out, const mesh::OptimizeStatistics& statistics)
+    {
+        out << "{ \"acmr_before\": " << statistics.cacheBefore.acmr << ", \"acmr_after\": " << statistics.cacheAfter.acmr
+            << ", \"atvr_before\": " << statistics.cacheBefore.atvr << ", \"atvr_after\": " << statistics.cacheAfter.atvr
+            << ", \"overfetch_before\": " << statistics.fetchBefore.overfetch << ", \"overfetch_after\": " << statistics.fetchAfter.overfetch << " }";
+    }
+
+    void writeUploads(std::ostream& out, const std::vector<Device::UploadRecord>& records)
+    {
+        out << "[";
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            out << (i ? ", " : "") << "{ \"resource\": \"" << records[i].resource << "\", \"path\": \"" << toString(records[i].path)
+                << "\", \"bytes\": " << records[i].size << " }";
+        }
+        out << "]";
+    }
+
+    void writeMemory(std::ostream& out, const MemoryTypeTable& memoryTypes, const std::vector<VkDeviceSize>& heapUsage)
+    {
+        out << "{\n    \"heaps\": [";
+        for (uint32_t i = 0; i < memoryTypes.getHeapCount(); ++i)
+        {
+            out << (i ? ", " : "") << "{ \"size\": " << memoryTypes.getHeapSize(i)
+                << ", \"budget\": " << memoryTypes.getHeapBudget(i)
+                << ", \"used\": " << (i < heapUsage.size() ? heapUsage[i] : 0) << " }";
+        }
+
+        out << "],\n    \"types\": [";
+        for (uint32_t i = 0; i < memoryTypes.getTypeCount(); ++i)
+        {
+            const VkMemoryPropertyFlags flags = memoryTypes.getTypeFlags(i);
+            out << (i ? ", " : "") << "{ \"heap\": " << memoryTypes.getHeapIndex(i)
+                << ", \"device_local\": " << ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? "true" : "false")
+                << ", \"host_visible\": " << ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? "true" : "false")
+                << ", \"host_coherent\": " << ((flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? "true" : "false")
+                << ", \"host_cached\": " << ((flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? "true" : "false") << " }";
+        }
+        out << "]\n  }";
+    }
+
+    // FNV-1a, to compare the rendered images of runs with different settings
+    uint64_t hash(const std::vector<uint8_t>& data)
+    {
+        uint64_t value = 14695981039346656037ull;
+        for (uint8_t byte : data)
+        {
+            value = (value ^ byte) * 1099511628211ull;
+        }
+        return value;
+    }
+
+    std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try
+    {
+        if (!parseOptions(argc, argv, options))
+        {
+            printUsage();
+            return -1;
+        }
+    }
+    catch (const std::exception&)
+    {
+        printUsage();
+        return -1;
+    }
+
+    if (!options.trace.empty())
+    {
+        trace::start(options.traceFirstFrame, options.traceFrameCount);
+        trace::setThreadName("main");
+    }
+
+    BenchmarkRenderer renderer;
+    renderer.setSettings(options.scene);
+
+    const auto initStart = std::chrono::high_resolution_clock::now();
+    if (!renderer.initHeadless(options.width, options.height))
+        return -1;
+    const double initTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - initStart).count();
+
+    for (uint32_t i = 0; i < options.warmupFrames; ++i)
+    {
+        renderer.draw();
+    }
+
+    // the GPU times of a frame are read back frames in flight later, when its slot is reused
+    const GpuProfiler& profiler = renderer.getGpuProfiler();
+    uint64_t resultCount = profiler.getResultCount();
+
+    std::vector<double> cpuFrameTimes;
+    std::vector<double> gpuFrameTimes;
+    std::vector<double> gpuRenderPassTimes;
+    cpuFrameTimes.reserve(options.frames);
+    for (uint32_t i = 0; i < options.frames; ++i)
+    {
+        renderer.draw();
+        cpuFrameTimes.push_back(renderer.getFrameTime());
+
+        if (profiler.getResultCount() != resultCount)
+        {
+            resultCount = profiler.getResultCount();
+            gpuFrameTimes.push_back(profiler.getScopeTime("frame"));
+            gpuRenderPassTimes.push_back(profiler.getScopeTime("render pass"));
+        }
+    }
+
+    std::vector<uint8_t> pixels;
+    renderer.readLastFrame(pixels);
+
+    const BenchmarkRenderer::Settings& scene = renderer.getSettings();
+    const double uploadSeconds = renderer.getUploadTime() / 1000.0;
+    const double uploadMegabytes = renderer.getUploadBytes() / (1024.0 * 1024.0);
+
+    std::ostringstream json;
+    json << "{\n"
+        << "  \"device\": \"" << escape(renderer.getDeviceName()) << "\",\n"
+        << "  \"settings\": { \"width\": " << options.width << ", \"height\": " << options.height
+        << ", \"frames\": " << options.frames << ", \"warmup_frames\": " << options.warmupFrames
+        << ", \"quads\": " << scene.quadCount << ", \"draws\": " << scene.drawCount
+        << ", \"dynamic_quads\": " << scene.dynamicQuadCount
+        << ", \"interleaved\": " << (scene.vertexLayout == VertexBuffer::Layout::Interleaved ? "true" : "false")
+        << ", \"compact_vertices\": " << (scene.compactVertices ? "true" : "false")
+        << ", \"optimize_mesh\": " << (scene.optimizeMesh ? "true" : "false")
+        << ", \"instancing\": \"" << toString(scene.instancing) << "\""
+        << ", \"indirect\": " << (scene.indirect ? "true" : "false") << ", \"multi_draw_indirect\": " << (renderer.isMultiDrawIndirect() ? "true" : "false") << ", \"textures\": " << scene.textureCount << ", \"texture_size\": " << scene.textureSize << " },\n"
+        << "  \"init_ms\": " << initTime << ",\n"
+        << "  \"vertex_bytes\": " << renderer.getVertexSize() << ",\n"
+        << "  \"index_bytes\": " << renderer.getIndexSize() << ",\n"
+        << "  \"mesh\": ";
+    writeMeshStatistics(json, renderer.getMeshStatistics());
+    json << ",\n"
+        << "  \"upload\": { \"bytes\": " << renderer.getUploadBytes() << ", \"ms\": " << renderer.getUploadTime()
+        << ", \"mb_per_s\": " << (uploadSeconds > 0.0 ? uploadMegabytes / uploadSeconds : 0.0) << ", \"paths\": ";
+    writeUploads(json, renderer.getUploadRecords());
+    json << " },\n"
+        << "  \"cpu_frame_ms\": ";
+    writeStatistics(json, cpuFrameTimes);
+    json << ",\n  \"gpu_frame_ms\": ";
+    writeStatistics(json, gpuFrameTimes);
+    json << ",\n  \"gpu_render_pass_ms\": ";
+    writeStatistics(json, gpuRenderPassTimes);
+    json << ",\n  \"last_frame_hash\": \"" << std::hex << hash(pixels) << std::dec << "\"";
+    json << ",\n  \"memory\": ";
+    writeMemory(json, renderer.getMemoryTypes(), renderer.getHeapUsage());
+    json << "\n}\n";
+
+    renderer.destroy();
+
+    if (!options.trace.empty())
+    {
+        trace::stop();
+        trace::writeJson(options.trace);
+    }
+
+    if (options.output.empty())
+    {
+        std::cout << json.str();
+    }
+    else
+    {
+        std::ofstream file(options.output);
+        file << json.str();
+        if (!file)
+        {
+            std::cout << "Could not write " << options.output << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
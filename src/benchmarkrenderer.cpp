@@ -0,0 +1,412 @@
+#include "benchmarkrenderer.h"
+#include "vulkan/vulkanhelper.h"
+#include "vulkan/uploadbatch.h"
+#include "mesh/meshoptimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+std::string BenchmarkRenderer::getDeviceName() const
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_device.getVkPysicalDevice(), &properties);
+    return properties.deviceName;
+}
+
+bool BenchmarkRenderer::setup()
+{
+    m_settings.quadCount = std::max(m_settings.quadCount, 1u);
+    if (m_settings.instancing == Instancing::PerFrame && m_settings.quadCount * sizeof(QuadInstance) > m_frameArena.getFrameSize())
+    {
+        std::cout << "The instances don't fit into the frame arena, they are uploaded once instead" << std::endl;
+        m_settings.instancing = Instancing::Static;
+    }
+
+    if (m_settings.indirect && m_settings.instancing != Instancing::None && !m_device.getEnabledFeatures().drawIndirectFirstInstance)
+    {
+        std::cout << "Indirect instanced draws need drawIndirectFirstInstance, the draws are issued directly" << std::endl;
+        m_settings.indirect = false;
+    }
+
+    const char* vertexShader = m_settings.instancing != Instancing::None ? "data/shaders/instanced.vert.spv" : "data/shaders/simple.vert.spv";
+    if (!m_shader.createFromFiles(m_device.getVkDevice(), vertexShader, "data/shaders/simple.frag.spv"))
+        return false;
+
+    m_settings.textureCount = std::max(m_settings.textureCount, 1u);
+    m_settings.textureSize = std::max(m_settings.textureSize, 1u);
+    m_settings.drawCount = std::min(std::max(m_settings.drawCount, 1u), m_settings.quadCount);
+    // the dynamic quads reuse the start of the static index buffer in its original order and the pipeline's planar float layout
+    const bool floatPlanar = m_settings.vertexLayout == VertexBuffer::Layout::Planar && !m_settings.compactVertices;
+    const bool quadIndexBuffer = !m_settings.optimizeMesh && m_settings.instancing == Instancing::None;
+    m_settings.dynamicQuadCount = floatPlanar && quadIndexBuffer ? std::min(m_settings.dynamicQuadCount, m_settings.quadCount) : 0;
+
+    m_device.setDirectUploads(m_settings.directUploads);
+    m_device.clearUploadRecords();
+
+    const auto uploadStart = std::chrono::high_resolution_clock::now();
+
+    UploadBatch uploadBatch;
+    uploadBatch.begin(&m_device);
+
+    createTextures(uploadBatch);
+    if (m_settings.instancing != Instancing::None)
+        createInstancedQuads(uploadBatch);
+    else
+        createQuads(uploadBatch);
+    if (m_settings.indirect)
+        createIndirectDraws(uploadBatch);
+
+    uploadBatch.submit();
+    m_uploadBytes = m_device.getUploadedBytes(UploadPath::Staged) + m_device.getUploadedBytes(UploadPath::Direct);
+    uploadBatch.wait();
+
+    m_uploadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - uploadStart).count();
+
+    m_device.createSampler(m_sampler);
+
+    // the vector must not reallocate once samplers were added
+    m_descriptorSets.resize(m_settings.textureCount);
+    for (uint32_t i = 0; i < m_settings.textureCount; ++i)
+    {
+        m_descriptorSets[i].addSampler(m_textures[i].getImageView(), m_sampler);
+        m_descriptorSets[i].finalize(m_device.getVkDevice());
+    }
+
+    m_pipelineLayout.init(m_device.getVkDevice(), { m_descriptorSets[0].getLayout() });
+
+    PipelineSettings settings;
+
+    m_pipeline.init(&m_device,
+        m_renderPass.getVkRenderPass(),
+        m_pipelineLayout.getVkPipelineLayout(),
+        settings,
+        m_shader.getShaderStages(),
+        &m_vertexBuffer);
+
+    return true;
+}
+
+void BenchmarkRenderer::createTextures(UploadBatch& uploadBatch)
+{
+    const uint32_t size = m_settings.textureSize;
+    std::vector<uint8_t> pixels(size * size * 4);
+
+    m_textures.resize(m_settings.textureCount);
+    for (uint32_t i = 0; i < m_settings.textureCount; ++i)
+    {
+        // checkerboard with a different tint per texture, so every texture has to be fetched for real
+        const uint8_t tint = static_cast<uint8_t>(i * 53);
+        for (uint32_t y = 0; y < size; ++y)
+        {
+            for (uint32_t x = 0; x < size; ++x)
+            {
+                uint8_t* texel = &pixels[(y * size + x) * 4];
+                const bool white = ((x / 8) + (y / 8)) % 2 == 0;
+                texel[0] = white ? 255 : tint;
+                texel[1] = white ? 255 : static_cast<uint8_t>(255 - tint);
+                texel[2] = white ? 255 : static_cast<uint8_t>(x * 255 / size);
+                texel[3] = 255;
+            }
+        }
+
+        m_textures[i].createFromPixels(&m_device, pixels.data(), size, size, &uploadBatch);
+    }
+}
+
+void BenchmarkRenderer::createQuads(UploadBatch& uploadBatch)
+{
+    const uint32_t quadCount = m_settings.quadCount;
+    const uint32_t vertexCount = quadCount * 4;
+
+    mesh::Mesh quads;
+    quads.vertexCount = vertexCount;
+    quads.attributes.resize(3);
+    quads.attributes[0] = { 0, 2, std::vector<float>(vertexCount * 2) };
+    quads.attributes[1] = { 1, 2, std::vector<float>(vertexCount * 2) };
+    quads.attributes[2] = { 2, 3, std::vector<float>(vertexCount * 3) };
+    std::vector<float>& vertices = quads.attributes[0].data;
+    std::vector<float>& texCoords = quads.attributes[1].data;
+    std::vector<float>& colors = quads.attributes[2].data;
+
+    // quads on a square grid covering the viewport, with a small gap between them
+    const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(quadCount))));
+    const float cellSize = 2.0f / columns;
+    const float quadSize = cellSize * 0.8f;
+
+    const float corners[4][2] = { { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f } };
+
+    for (uint32_t quad = 0; quad < quadCount; ++quad)
+    {
+        const float x = -1.0f + (quad % columns) * cellSize;
+        const float y = -1.0f + (quad / columns) * cellSize;
+
+        for (uint32_t corner = 0; corner < 4; ++corner)
+        {
+            const uint32_t vertex = quad * 4 + corner;
+            vertices[vertex * 2 + 0] = x + corners[corner][0] * quadSize;
+            vertices[vertex * 2 + 1] = y + corners[corner][1] * quadSize;
+            texCoords[vertex * 2 + 0] = corners[corner][0];
+            texCoords[vertex * 2 + 1] = corners[corner][1];
+            colors[vertex * 3 + 0] = static_cast<float>(quad % 7) / 6.0f;
+            colors[vertex * 3 + 1] = static_cast<float>(quad % 5) / 4.0f;
+            colors[vertex * 3 + 2] = 1.0f;
+        }
+    }
+
+    const uint32_t quadIndices[] = { 0, 1, 2, 2, 3, 0 };
+    quads.indices.resize(quadCount * 6);
+    for (uint32_t i = 0; i < quads.indices.size(); ++i)
+        quads.indices[i] = (i / 6) * 4 + quadIndices[i % 6];
+
+    m_meshStatistics = mesh::OptimizeStatistics();
+    if (m_settings.optimizeMesh)
+        m_meshStatistics = mesh::optimize(quads);
+
+    // positions and texture coordinates are in [-1, 1] and [0, 1], colors get an unused alpha
+    // because three component 8 bit formats are optional for vertex buffers
+    const bool compact = m_settings.compactVertices;
+    const std::vector<VertexBuffer::AttributeDescription> attribDesc =
+    {
+        { 0, 2, quads.vertexCount, vertices.data(), compact ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_UNDEFINED },
+        { 1, 2, quads.vertexCount, texCoords.data(), compact ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_UNDEFINED },
+        { 2, 3, quads.vertexCount, colors.data(), compact ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_UNDEFINED }
+    };
+
+    m_vertexBuffer.init(&m_device, attribDesc, &uploadBatch, m_settings.vertexLayout);
+    m_vertexBuffer.setIndices(quads.indices.data(), static_cast<uint32_t>(quads.indices.size()), &uploadBatch);
+}
+
+void BenchmarkRenderer::createInstancedQuads(UploadBatch& uploadBatch)
+{
+    // the corners of the unit quad are its texture coordinates as well
+    const float corners[] = { 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f };
+    const uint16_t indices[] = { 0, 1, 2, 2, 3, 0 };
+
+    const std::vector<VertexBuffer::AttributeDescription> attribDesc =
+    {
+        { 0, 2, 4, corners }
+    };
+
+    m_vertexBuffer.init(&m_device, attribDesc, &uploadBatch, m_settings.vertexLayout);
+    m_vertexBuffer.setIndices(indices, 6, &uploadBatch);
+    m_vertexBuffer.setInstanceLayout(sizeof(QuadInstance),
+    {
+        { 3, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(QuadInstance, rect) },
+        { 4, VK_FORMAT_R8G8B8A8_UNORM, offsetof(QuadInstance, color) }
+    });
+
+    if (m_settings.instancing == Instancing::Static)
+    {
+        std::vector<QuadInstance> instances(m_settings.quadCount);
+        writeQuadInstances(instances.data());
+        m_vertexBuffer.setInstances(instances.data(), m_settings.quadCount, &uploadBatch);
+    }
+}
+
+void BenchmarkRenderer::writeQuadInstances(QuadInstance* instances) const
+{
+    // the same grid as the quads with four vertices each. Per frame instances sway a little, so they really change.
+    const uint32_t quadCount = m_settings.quadCount;
+    const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(quadCount))));
+    const float cellSize = 2.0f / columns;
+    const float quadSize = cellSize * 0.8f;
+    const float time = m_settings.instancing == Instancing::PerFrame ? static_cast<float>(getFrameCount()) * 0.05f : 0.0f;
+    const float sway = m_settings.instancing == Instancing::PerFrame ? cellSize * 0.1f : 0.0f;
+
+    for (uint32_t quad = 0; quad < quadCount; ++quad)
+    {
+        QuadInstance& instance = instances[quad];
+        instance.rect[0] = -1.0f + (quad % columns) * cellSize + std::sin(time + static_cast<float>(quad)) * sway;
+        instance.rect[1] = -1.0f + (quad / columns) * cellSize;
+        instance.rect[2] = quadSize;
+        instance.rect[3] = quadSize;
+
+        const uint32_t red = (quad % 7) * 255 / 6;
+        const uint32_t green = (quad % 5) * 255 / 4;
+        instance.color = red | (green << 8) | (255u << 16) | (255u << 24);
+    }
+}
+
+void BenchmarkRenderer::createIndirectDraws(UploadBatch& uploadBatch)
+{
+    const uint32_t quadCount = m_settings.quadCount;
+    const uint32_t drawCount = m_settings.drawCount;
+    const uint32_t setCount = std::min(m_settings.textureCount, drawCount);
+    const bool instanced = m_settings.instancing != Instancing::None;
+
+    // the same draws as the direct path, sorted by descriptor set. The quads don't overlap, so the order doesn't matter.
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    commands.reserve(drawCount);
+    m_indirectGroups.clear();
+    for (uint32_t set = 0; set < setCount; ++set)
+    {
+        m_indirectGroups.push_back({ set, static_cast<uint32_t>(commands.size()), 0 });
+        for (uint32_t draw = set; draw < drawCount; draw += m_settings.textureCount)
+        {
+            const uint32_t firstQuad = static_cast<uint32_t>(static_cast<uint64_t>(quadCount) * draw / drawCount);
+            const uint32_t lastQuad = static_cast<uint32_t>(static_cast<uint64_t>(quadCount) * (draw + 1) / drawCount);
+
+            VkDrawIndexedIndirectCommand command = {};
+            command.indexCount = instanced ? 6 : (lastQuad - firstQuad) * 6;
+            command.instanceCount = instanced ? lastQuad - firstQuad : 1;
+            command.firstIndex = instanced ? 0 : firstQuad * 6;
+            command.vertexOffset = 0;
+            command.firstInstance = instanced ? firstQuad : 0;
+            commands.push_back(command);
+        }
+        m_indirectGroups.back().commandCount = static_cast<uint32_t>(commands.size()) - m_indirectGroups.back().firstCommand;
+    }
+
+    m_indirectBuffer.init(&m_device, commands, &uploadBatch);
+}
+
+void BenchmarkRenderer::recordFrame(VkCommandBuffer commandBuffer, uint32_t imageId)
+{
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = m_renderPass.getVkRenderPass();
+    renderPassInfo.framebuffer = m_framebuffers[imageId].getVkFramebuffer();
+    renderPassInfo.renderArea.offset = { 0, 0 };
+    renderPassInfo.renderArea.extent = m_swapChain.getImageExtent();
+    VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearColor;
+
+    m_gpuProfiler.beginScope(commandBuffer, "render pass");
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    const VkExtent2D extent = m_swapChain.getImageExtent();
+    const uint32_t quadCount = m_settings.quadCount;
+    const uint32_t drawCount = m_settings.drawCount;
+
+    // written before the workers start, which only bind the allocations
+    FrameArena::Allocation dynamicAttributes[3];
+    const bool drawDynamicQuads = m_settings.dynamicQuadCount > 0 && writeDynamicQuads(dynamicAttributes);
+
+    FrameArena::Allocation instances;
+    if (m_settings.instancing == Instancing::PerFrame)
+    {
+        // setup checked that they fit
+        m_frameArena.allocateVertices(quadCount * sizeof(QuadInstance), instances);
+        writeQuadInstances(static_cast<QuadInstance*>(instances.data));
+    }
+    const bool instanced = m_settings.instancing != Instancing::None;
+
+    // indirect draws are recorded per group of commands, their number doesn't grow with the draw count
+    const uint32_t itemCount = m_settings.indirect ? static_cast<uint32_t>(m_indirectGroups.size()) : drawCount;
+
+    m_commandRecorder.record(commandBuffer, m_renderPass.getVkRenderPass(), 0, m_framebuffers[imageId].getVkFramebuffer(), itemCount,
+        [&](VkCommandBuffer secondary, uint32_t begin, uint32_t end)
+    {
+        VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f };
+        vkCmdSetViewport(secondary, 0, 1, &viewport);
+
+        VkRect2D scissor = { {0, 0}, extent };
+        vkCmdSetScissor(secondary, 0, 1, &scissor);
+
+        vkCmdBindPipeline(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getVkPipeline());
+        m_vertexBuffer.bind(secondary);
+        if (instances.buffer != VK_NULL_HANDLE)
+            m_vertexBuffer.bindInstances(secondary, instances.buffer, instances.offset);
+
+        if (m_settings.indirect)
+        {
+            for (uint32_t group = begin; group < end; ++group)
+            {
+                m_descriptorSets[m_indirectGroups[group].descriptorSet].bind(secondary, m_pipelineLayout.getVkPipelineLayout());
+                m_indirectBuffer.draw(secondary, m_indirectGroups[group].firstCommand, m_indirectGroups[group].commandCount);
+            }
+        }
+        else
+        {
+            for (uint32_t draw = begin; draw < end; ++draw)
+            {
+                const uint32_t firstQuad = static_cast<uint32_t>(static_cast<uint64_t>(quadCount) * draw / drawCount);
+                const uint32_t lastQuad = static_cast<uint32_t>(static_cast<uint64_t>(quadCount) * (draw + 1) / drawCount);
+
+                m_descriptorSets[draw % m_descriptorSets.size()].bind(secondary, m_pipelineLayout.getVkPipelineLayout());
+                if (instanced)
+                    vkCmdDrawIndexed(secondary, 6, lastQuad - firstQuad, 0, 0, firstQuad);
+                else
+                    vkCmdDrawIndexed(secondary, (lastQuad - firstQuad) * 6, 1, firstQuad * 6, 0, 0);
+            }
+        }
+
+        if (drawDynamicQuads && end == itemCount)
+        {
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+                vkCmdBindVertexBuffers(secondary, i, 1, &dynamicAttributes[i].buffer, &dynamicAttributes[i].offset);
+            }
+            vkCmdDrawIndexed(secondary, m_settings.dynamicQuadCount * 6, 1, 0, 0, 0);
+        }
+    });
+
+    vkCmdEndRenderPass(commandBuffer);
+    m_gpuProfiler.endScope(commandBuffer);
+}
+
+bool BenchmarkRenderer::writeDynamicQuads(FrameArena::Allocation (&attributes)[3])
+{
+    const uint32_t vertexCount = m_settings.dynamicQuadCount * 4;
+    if (!m_frameArena.allocateVertices(vertexCount * 2 * sizeof(float), attributes[0]) ||
+        !m_frameArena.allocateVertices(vertexCount * 2 * sizeof(float), attributes[1]) ||
+        !m_frameArena.allocateVertices(vertexCount * 3 * sizeof(float), attributes[2]))
+    {
+        return false;
+    }
+
+    float* vertices = static_cast<float*>(attributes[0].data);
+    float* texCoords = static_cast<float*>(attributes[1].data);
+    float* colors = static_cast<float*>(attributes[2].data);
+
+    // small quads circling around the top left corner of the static quads they cover
+    const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(m_settings.quadCount))));
+    const float cellSize = 2.0f / columns;
+    const float quadSize = cellSize * 0.4f;
+    const float time = static_cast<float>(getFrameCount()) * 0.05f;
+
+    const float corners[4][2] = { { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f } };
+
+    for (uint32_t quad = 0; quad < m_settings.dynamicQuadCount; ++quad)
+    {
+        const float angle = time + static_cast<float>(quad);
+        const float x = -1.0f + (quad % columns) * cellSize + (std::cos(angle) + 1.0f) * 0.2f * cellSize;
+        const float y = -1.0f + (quad / columns) * cellSize + (std::sin(angle) + 1.0f) * 0.2f * cellSize;
+
+        for (uint32_t corner = 0; corner < 4; ++corner)
+        {
+            const uint32_t vertex = quad * 4 + corner;
+            vertices[vertex * 2 + 0] = x + corners[corner][0] * quadSize;
+            vertices[vertex * 2 + 1] = y + corners[corner][1] * quadSize;
+            texCoords[vertex * 2 + 0] = corners[corner][0];
+            texCoords[vertex * 2 + 1] = corners[corner][1];
+            colors[vertex * 3 + 0] = 1.0f;
+            colors[vertex * 3 + 1] = 1.0f;
+            colors[vertex * 3 + 2] = 0.0f;
+        }
+    }
+
+    return true;
+}
+
+void BenchmarkRenderer::shutdown()
+{
+    for (auto& descriptorSet : m_descriptorSets)
+    {
+        descriptorSet.destroy(&m_device);
+    }
+    m_shader.destory();
+    m_vertexBuffer.destroy();
+    m_indirectBuffer.destroy();
+    m_pipeline.destroy();
+    m_pipelineLayout.destroy();
+    for (auto& texture : m_textures)
+    {
+        texture.destroy();
+    }
+    vkDestroySampler(m_device.getVkDevice(), m_sampler, nullptr);
+}
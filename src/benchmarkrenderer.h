@@ -0,0 +1,116 @@
+#pragma once
+
+#include "vulkan/basicrenderer.h"
+#include "vulkan/shader.h"
+#include "vulkan/descriptorset.h"
+#include "vulkan/texture.h"
+#include "vulkan/pipeline.h"
+#include "vulkan/vertexbuffer.h"
+#include "vulkan/indirectdrawbuffer.h"
+#include "mesh/meshoptimizer.h"
+
+#include <string>
+#include <vector>
+
+// Draws a grid of textured quads split into a configurable number of draw calls,
+// the commands are recorded every frame on all cores
+class BenchmarkRenderer : public BasicRenderer
+{
+public:
+    enum class Instancing
+    {
+        // four vertices per quad
+        None,
+        // one unit quad drawn as instances uploaded once
+        Static,
+        // instances rewritten every frame through the frame arena, like moving sprites
+        PerFrame
+    };
+
+    struct Settings
+    {
+        uint32_t quadCount = 10000;
+        uint32_t textureCount = 16;
+        uint32_t textureSize = 256;
+        uint32_t drawCount = 1000;
+        // buffers are written directly when they land in host visible device local memory
+        bool directUploads = true;
+        // quads whose vertices are rewritten every frame through the frame arena, at most quadCount
+        uint32_t dynamicQuadCount = 0;
+        VertexBuffer::Layout vertexLayout = VertexBuffer::Layout::Planar;
+        // 16 bit normalized positions and texture coordinates and 8 bit colors instead of 32 bit floats
+        bool compactVertices = false;
+        // runs the quads through the mesh optimizer before they are uploaded
+        bool optimizeMesh = false;
+        Instancing instancing = Instancing::None;
+        // the draws are indirect commands in a GPU buffer, issued with one call per texture if multi draw is supported
+        bool indirect = false;
+    };
+
+    // Has to be called before init
+    void setSettings(const Settings& settings) { m_settings = settings; }
+    const Settings& getSettings() const { return m_settings; }
+
+    std::string getDeviceName() const;
+    uint32_t getVertexSize() const { return m_vertexBuffer.getVertexSize(); }
+    uint32_t getIndexSize() const { return m_vertexBuffer.getIndexType() == VK_INDEX_TYPE_UINT16 ? 2 : 4; }
+    // Vertex cache and fetch statistics before and after optimizing, all zero if the mesh wasn't optimized
+    const mesh::OptimizeStatistics& getMeshStatistics() const { return m_meshStatistics; }
+    bool isMultiDrawIndirect() const { return m_settings.indirect && m_indirectBuffer.isMultiDraw(); }
+    const MemoryTypeTable& getMemoryTypes() const { return m_device.getMemoryTypes(); }
+    const std::vector<VkDeviceSize>& getHeapUsage() const { return m_device.getHeapUsage(); }
+
+    // Data uploaded during setup and the time from writing the first byte until the GPU finished copying
+    uint64_t getUploadBytes() const { return m_uploadBytes; }
+    // The path every upload of setup took
+    const std::vector<Device::UploadRecord>& getUploadRecords() const { return m_device.getUploadRecords(); }
+    double getUploadTime() const { return m_uploadTime; }
+
+private:
+    bool setup() override;
+    void shutdown() override;
+    void fillCommandBuffers() override {}
+
+    bool recordsEveryFrame() const override { return true; }
+    void recordFrame(VkCommandBuffer commandBuffer, uint32_t imageId) override;
+
+    // Per instance attributes of a quad: rectangle at location 3, color at location 4
+    struct QuadInstance
+    {
+        float rect[4];
+        uint32_t color;
+    };
+
+    void createQuads(UploadBatch& uploadBatch);
+    void createInstancedQuads(UploadBatch& uploadBatch);
+    void writeQuadInstances(QuadInstance* instances) const;
+    void createIndirectDraws(UploadBatch& uploadBatch);
+    void createTextures(UploadBatch& uploadBatch);
+    // Returns false if the frame arena is full
+    bool writeDynamicQuads(FrameArena::Allocation (&attributes)[3]);
+
+    Settings m_settings;
+
+    std::vector<Texture> m_textures;
+    // one set per texture, all with the same layout
+    std::vector<DescriptorSet> m_descriptorSets;
+    PipelineLayout m_pipelineLayout;
+    Pipeline m_pipeline;
+    VertexBuffer m_vertexBuffer;
+
+    // consecutive indirect commands of the draws that use one descriptor set
+    struct IndirectGroup
+    {
+        uint32_t descriptorSet;
+        uint32_t firstCommand;
+        uint32_t commandCount;
+    };
+    IndirectDrawBuffer m_indirectBuffer;
+    std::vector<IndirectGroup> m_indirectGroups;
+    Shader m_shader;
+    VkSampler m_sampler = VK_NULL_HANDLE;
+
+    mesh::OptimizeStatistics m_meshStatistics;
+    uint64_t m_uploadBytes = 0;
+    double m_uploadTime = 0.0;
+};
@@ -1,11 +1,99 @@
 #include "simplerenderer.h"
+#include "vulkan/trace.h"
 
 #include <SDL.h>
 #include <stdint.h>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <iostream>
 
+namespace
+{
+    // Renders a fixed number of frames into offscreen images, no display or window system needed
+    int runHeadless(uint32_t numFrames)
+    {
+        SimpleRenderer renderer;
+        if (!renderer.initHeadless(640, 480))
+            return -1;
+
+        for (uint32_t i = 0; i < numFrames; i++)
+        {
+            renderer.draw();
+        }
+
+        std::cout << "Rendered " << renderer.getFrameCount() << " frames headless, last frame time " << renderer.getFrameTime() << " ms" << std::endl;
+
+        renderer.destroy();
+        return 0;
+    }
+
+    // Leaves count unchanged and returns false unless arg is a plain decimal number
+    bool parseCount(const char* arg, uint64_t& count)
+    {
+        if (!std::isdigit(static_cast<unsigned char>(arg[0])))
+            return false;
+
+        char* end = nullptr;
+        const uint64_t value = std::strtoull(arg, &end, 10);
+        if (*end != '\0')
+            return false;
+
+        count = value;
+        return true;
+    }
+
+    // Traces the first frames if the arguments contain --trace FILE [FRAME_COUNT], the file is written on exit.
+    // The trace arguments are removed, the others are left for the caller.
+    std::string startTrace(int& argc, char* argv[])
+    {
+        for (int i = 1; i + 1 < argc; ++i)
+        {
+            if (std::string(argv[i]) == "--trace")
+            {
+                const std::string file = argv[i + 1];
+                uint64_t frameCount = 300;
+                const bool hasFrameCount = i + 2 < argc && parseCount(argv[i + 2], frameCount);
+                trace::start(0, frameCount);
+                trace::setThreadName("main");
+
+                const int used = hasFrameCount ? 3 : 2;
+                for (int j = i + used; j < argc; ++j)
+                {
+                    argv[j - used] = argv[j];
+                }
+                argc -= used;
+                argv[argc] = nullptr;
+                return file;
+            }
+        }
+        return std::string();
+    }
+
+    void writeTrace(const std::string& file)
+    {
+        if (!file.empty())
+        {
+            trace::stop();
+            trace::writeJson(file);
+        }
+    }
+}
 
 int main(int argc, char *argv[])
 {
+    const std::string traceFile = startTrace(argc, argv);
+
+    if (argc > 1 && std::string(argv[1]) == "--headless")
+    {
+        uint64_t numFrames = 100;
+        if (argc > 2)
+            parseCount(argv[2], numFrames);
+        const int result = runHeadless(static_cast<uint32_t>(numFrames));
+        writeTrace(traceFile);
+        return result;
+    }
+
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_Window *window = SDL_CreateWindow(
@@ -26,6 +114,11 @@ int main(int argc, char *argv[])
     // main loop
     bool quit = false;
     bool pause = false;
+    // dragging the window edge sends a burst of size events, only the last one per frame is applied
+    bool resizePending = false;
+    int pendingWidth = 0;
+    int pendingHeight = 0;
+    uint32_t lastTitleUpdate = SDL_GetTicks();
     SDL_Event event;
     while (!quit)
     {
@@ -36,11 +129,28 @@ int main(int argc, char *argv[])
             case SDL_QUIT:
                 quit = true;
                 break;
+            case SDL_KEYDOWN:
+                // 1, 2 and 3 switch between the present policies
+                switch (event.key.keysym.sym)
+                {
+                    case SDLK_1:
+                        renderer.setPresentPolicy(PresentPolicy::LowLatency);
+                        break;
+                    case SDLK_2:
+                        renderer.setPresentPolicy(PresentPolicy::MaxThroughput);
+                        break;
+                    case SDLK_3:
+                        renderer.setPresentPolicy(PresentPolicy::PowerSaving);
+                        break;
+                }
+                break;
             case SDL_WINDOWEVENT:
                 switch (event.window.event)
                 {
                     case SDL_WINDOWEVENT_SIZE_CHANGED:
-                        pause = !renderer.resize(event.window.data1, event.window.data2);
+                        resizePending = true;
+                        pendingWidth = event.window.data1;
+                        pendingHeight = event.window.data2;
                         break;
                     case SDL_WINDOWEVENT_MINIMIZED:
                         pause = true;
@@ -54,16 +164,33 @@ int main(int argc, char *argv[])
                 }
                 break;
             }         
+        }
+        if (resizePending)
+        {
+            resizePending = false;
+            pause = !renderer.resize(pendingWidth, pendingHeight);
         }
         if (!pause)
         {
             renderer.draw();
         }
+
+        // show the averaged frame time once per second
+        if (SDL_GetTicks() - lastTitleUpdate >= 1000)
+        {
+            lastTitleUpdate = SDL_GetTicks();
+            const double frameTime = renderer.getAverageFrameTime();
+            const std::string title = "myVulkan - " + std::to_string(frameTime) + " ms (" + std::to_string(frameTime > 0.0 ? static_cast<int>(1000.0 / frameTime) : 0) + " fps) - "
+                + toString(renderer.getPresentPolicy()) + ", " + toString(renderer.getPresentMode());
+            SDL_SetWindowTitle(window, title.c_str());
+        }
     }
 
     renderer.destroy();
     SDL_DestroyWindow(window);
     SDL_Quit();
 
+    writeTrace(traceFile);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,596 @@
+#include "meshoptimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    // FIFO cache over vertex indices, transform returns true on a miss
+    class FifoCache
+    {
+    public:
+        FifoCache(uint32_t vertexCount, uint32_t cacheSize)
+            : m_timestamps(vertexCount, 0)
+            , m_cacheSize(cacheSize)
+        {
+        }
+
+        // a vertex is in the cache if fewer than cacheSize misses happened since it was transformed
+        bool transform(uint32_t vertex)
+        {
+            if (m_timestamps[vertex] != 0 && m_time - m_timestamps[vertex] < m_cacheSize)
+                return false;
+
+            m_timestamps[vertex] = ++m_time;
+            return true;
+        }
+
+        void clear()
+        {
+            // pushing the time past the cache size evicts everything
+            m_time += m_cacheSize;
+        }
+
+    private:
+        std::vector<uint32_t> m_timestamps;
+        uint32_t m_time = 0;
+        uint32_t m_cacheSize;
+    };
+
+    // Vertex scores of the Forsyth algorithm, for an LRU cache larger than the hardware FIFO
+    const uint32_t ScoreCacheSize = 32;
+    const uint32_t ScoreValenceSize = 32;
+
+    class VertexScores
+    {
+    public:
+        VertexScores()
+        {
+            for (uint32_t i = 0; i < ScoreCacheSize; ++i)
+            {
+                // the last triangle's vertices are scored equally, so its winding order doesn't matter
+                m_cache[i] = i < 3 ? 0.75f : std::pow(1.0f - static_cast<float>(i - 3) / (ScoreCacheSize - 3), 1.5f);
+            }
+            for (uint32_t i = 0; i < ScoreValenceSize; ++i)
+            {
+                m_valence[i] = i == 0 ? 0.0f : 2.0f / std::sqrt(static_cast<float>(i));
+            }
+        }
+
+        // cachePosition is -1 for vertices outside the cache. Vertices of finished triangles only are never picked.
+        float get(int cachePosition, uint32_t liveTriangles) const
+        {
+            if (liveTriangles == 0)
+                return -1.0f;
+
+            const float valence = liveTriangles < ScoreValenceSize ? m_valence[liveTriangles] : 2.0f / std::sqrt(static_cast<float>(liveTriangles));
+            return (cachePosition >= 0 ? m_cache[cachePosition] : 0.0f) + valence;
+        }
+
+    private:
+        float m_cache[ScoreCacheSize];
+        float m_valence[ScoreValenceSize];
+    };
+
+    struct Vector3
+    {
+        float x, y, z;
+    };
+
+    Vector3 getPosition(const float* positions, uint32_t positionStride, uint32_t componentCount, uint32_t vertex)
+    {
+        const float* p = positions + static_cast<size_t>(vertex) * positionStride;
+        return { p[0], p[1], componentCount > 2 ? p[2] : 0.0f };
+    }
+
+    struct Cluster
+    {
+        size_t begin;
+        size_t end;
+        float sortKey;
+    };
+
+    const char FileMagic[4] = { 'M', 'E', 'S', 'H' };
+    const uint32_t FileVersion = 1;
+
+    template<typename T>
+    void writeValue(std::ofstream& file, const T& value)
+    {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    bool readValue(std::ifstream& file, T& value)
+    {
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+}
+
+mesh::CacheStatistics mesh::analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+    CacheStatistics statistics;
+    if (indexCount == 0 || vertexCount == 0)
+        return statistics;
+
+    FifoCache cache(vertexCount, cacheSize);
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        assert(indices[i] < vertexCount);
+        statistics.transformedVertices += cache.transform(indices[i]) ? 1 : 0;
+    }
+
+    statistics.acmr = static_cast<float>(statistics.transformedVertices) / (indexCount / 3);
+    statistics.atvr = static_cast<float>(statistics.transformedVertices) / vertexCount;
+    return statistics;
+}
+
+mesh::FetchStatistics mesh::analyzeVertexFetch(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t vertexSize)
+{
+    const uint32_t LineSize = 64;
+    const uint32_t LineCount = 64;
+
+    FetchStatistics statistics;
+    std::vector<uint8_t> referenced(vertexCount, 0);
+    uint64_t lines[LineCount];
+    std::fill(lines, lines + LineCount, ~0ull);
+
+    uint64_t referencedBytes = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        const uint32_t vertex = indices[i];
+        assert(vertex < vertexCount);
+
+        if (!referenced[vertex])
+        {
+            referenced[vertex] = 1;
+            referencedBytes += vertexSize;
+        }
+
+        const uint64_t begin = static_cast<uint64_t>(vertex) * vertexSize;
+        for (uint64_t line = begin / LineSize; line <= (begin + vertexSize - 1) / LineSize; ++line)
+        {
+            uint64_t& slot = lines[line % LineCount];
+            if (slot != line)
+            {
+                slot = line;
+                statistics.bytesFetched += LineSize;
+            }
+        }
+    }
+
+    statistics.overfetch = referencedBytes > 0 ? static_cast<float>(statistics.bytesFetched) / referencedBytes : 0.0f;
+    return statistics;
+}
+
+void mesh::optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, uint32_t vertexCount)
+{
+    assert(indexCount % 3 == 0);
+    assert(dst != indices);
+
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    static const VertexScores scores;
+
+    // triangles using every vertex, the live ones of vertex v are adjacency[offsets[v], offsets[v] + liveTriangles[v])
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        assert(indices[i] < vertexCount);
+        liveTriangles[indices[i]]++;
+    }
+
+    std::vector<uint32_t> offsets(vertexCount);
+    uint32_t offset = 0;
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        offsets[v] = offset;
+        offset += liveTriangles[v];
+    }
+
+    std::vector<uint32_t> adjacency(indexCount);
+    std::vector<uint32_t> fill(offsets);
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<float> vertexScores(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        vertexScores[v] = scores.get(-1, liveTriangles[v]);
+    }
+
+    std::vector<float> triangleScores(triangleCount);
+    uint32_t bestTriangle = 0;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+        if (triangleScores[t] > triangleScores[bestTriangle])
+            bestTriangle = static_cast<uint32_t>(t);
+    }
+
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    uint32_t cache[ScoreCacheSize + 3];
+    uint32_t cacheCount = 0;
+    size_t inputCursor = 0;
+
+    for (size_t written = 0; written < triangleCount; ++written)
+    {
+        if (bestTriangle == ~0u)
+        {
+            // nothing in the cache has live triangles left, continue with the next one in input order
+            while (emitted[inputCursor])
+                ++inputCursor;
+            bestTriangle = static_cast<uint32_t>(inputCursor);
+        }
+
+        const uint32_t* triangle = indices + static_cast<size_t>(bestTriangle) * 3;
+        memcpy(dst + written * 3, triangle, 3 * sizeof(uint32_t));
+        emitted[bestTriangle] = 1;
+
+        // the triangle's vertices move to the front of the cache, the others shift back
+        uint32_t newCache[ScoreCacheSize + 3];
+        uint32_t newCacheCount = 0;
+        for (uint32_t k = 0; k < 3; ++k)
+        {
+            const uint32_t v = triangle[k];
+            if (std::find(newCache, newCache + newCacheCount, v) == newCache + newCacheCount)
+                newCache[newCacheCount++] = v;
+
+            uint32_t* begin = adjacency.data() + offsets[v];
+            uint32_t* end = begin + liveTriangles[v];
+            uint32_t* it = std::find(begin, end, bestTriangle);
+            assert(it != end);
+            *it = *(end - 1);
+            liveTriangles[v]--;
+        }
+        for (uint32_t i = 0; i < cacheCount; ++i)
+        {
+            const uint32_t v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                newCache[newCacheCount++] = v;
+        }
+
+        // rescore everything that moved, including the vertices that fell out of the cache
+        bestTriangle = ~0u;
+        float bestScore = -1.0f;
+        for (uint32_t i = 0; i < newCacheCount; ++i)
+        {
+            const uint32_t v = newCache[i];
+            const float score = scores.get(i < ScoreCacheSize ? static_cast<int>(i) : -1, liveTriangles[v]);
+            const float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+
+            const uint32_t* begin = adjacency.data() + offsets[v];
+            for (uint32_t j = 0; j < liveTriangles[v]; ++j)
+            {
+                triangleScores[begin[j]] += delta;
+            }
+        }
+
+        for (uint32_t i = 0; i < std::min(newCacheCount, ScoreCacheSize); ++i)
+        {
+            const uint32_t v = newCache[i];
+            const uint32_t* begin = adjacency.data() + offsets[v];
+            for (uint32_t j = 0; j < liveTriangles[v]; ++j)
+            {
+                if (triangleScores[begin[j]] > bestScore)
+                {
+                    bestScore = triangleScores[begin[j]];
+                    bestTriangle = begin[j];
+                }
+            }
+        }
+
+        cacheCount = std::min(newCacheCount, ScoreCacheSize);
+        memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+    }
+}
+
+void mesh::optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, uint32_t positionStride,
+    uint32_t componentCount, uint32_t vertexCount, float threshold)
+{
+    assert(indexCount % 3 == 0);
+    assert(dst != indices);
+    assert(componentCount >= 2);
+
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // hard boundaries: a triangle that misses the cache with all three vertices starts over anyway,
+    // so starting a cluster there costs nothing
+    std::vector<size_t> hardBoundaries;
+    FifoCache cache(vertexCount, DefaultCacheSize);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        uint32_t misses = 0;
+        for (uint32_t k = 0; k < 3; ++k)
+            misses += cache.transform(indices[t * 3 + k]) ? 1 : 0;
+
+        if (t == 0 || misses == 3)
+            hardBoundaries.push_back(t);
+    }
+    hardBoundaries.push_back(triangleCount);
+
+    // soft boundaries: split a cluster as soon as the part before the split is within threshold of the cluster's ACMR
+    std::vector<Cluster> clusters;
+    for (size_t i = 0; i + 1 < hardBoundaries.size(); ++i)
+    {
+        const size_t begin = hardBoundaries[i];
+        const size_t end = hardBoundaries[i + 1];
+
+        cache.clear();
+        uint32_t clusterMisses = 0;
+        for (size_t t = begin * 3; t < end * 3; ++t)
+            clusterMisses += cache.transform(indices[t]) ? 1 : 0;
+        const float clusterAcmr = static_cast<float>(clusterMisses) / (end - begin);
+
+        cache.clear();
+        size_t start = begin;
+        uint32_t misses = 0;
+        for (size_t t = begin; t < end; ++t)
+        {
+            for (uint32_t k = 0; k < 3; ++k)
+                misses += cache.transform(indices[t * 3 + k]) ? 1 : 0;
+
+            if (t + 1 < end && static_cast<float>(misses) / (t + 1 - start) <= clusterAcmr * threshold)
+            {
+                clusters.push_back({ start, t + 1, 0.0f });
+                start = t + 1;
+                misses = 0;
+                cache.clear();
+            }
+        }
+        clusters.push_back({ start, end, 0.0f });
+    }
+
+    // clusters facing away from the center of the mesh are drawn first, they are more likely in front of the others
+    Vector3 meshCentroid = { 0.0f, 0.0f, 0.0f };
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        const Vector3 p = getPosition(positions, positionStride, componentCount, indices[i]);
+        meshCentroid.x += p.x;
+        meshCentroid.y += p.y;
+        meshCentroid.z += p.z;
+    }
+    meshCentroid.x /= indexCount;
+    meshCentroid.y /= indexCount;
+    meshCentroid.z /= indexCount;
+
+    for (Cluster& cluster : clusters)
+    {
+        Vector3 centroid = { 0.0f, 0.0f, 0.0f };
+        Vector3 normal = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+        for (size_t t = cluster.begin; t < cluster.end; ++t)
+        {
+            const Vector3 a = getPosition(positions, positionStride, componentCount, indices[t * 3 + 0]);
+            const Vector3 b = getPosition(positions, positionStride, componentCount, indices[t * 3 + 1]);
+            const Vector3 c = getPosition(positions, positionStride, componentCount, indices[t * 3 + 2]);
+
+            const Vector3 ab = { b.x - a.x, b.y - a.y, b.z - a.z };
+            const Vector3 ac = { c.x - a.x, c.y - a.y, c.z - a.z };
+            const Vector3 n = { ab.y * ac.z - ab.z * ac.y, ab.z * ac.x - ab.x * ac.z, ab.x * ac.y - ab.y * ac.x };
+            const float triangleArea = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+
+            // area weighted, so slivers don't dominate
+            centroid.x += (a.x + b.x + c.x) * triangleArea;
+            centroid.y += (a.y + b.y + c.y) * triangleArea;
+            centroid.z += (a.z + b.z + c.z) * triangleArea;
+            normal.x += n.x;
+            normal.y += n.y;
+            normal.z += n.z;
+            area += triangleArea;
+        }
+
+        const float normalLength = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+        if (area > 0.0f && normalLength > 0.0f)
+        {
+            const float centroidScale = 1.0f / (area * 3.0f);
+            cluster.sortKey = ((centroid.x * centroidScale - meshCentroid.x) * normal.x +
+                (centroid.y * centroidScale - meshCentroid.y) * normal.y +
+                (centroid.z * centroidScale - meshCentroid.z) * normal.z) / normalLength;
+        }
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    uint32_t* out = dst;
+    for (const Cluster& cluster : clusters)
+    {
+        const size_t count = (cluster.end - cluster.begin) * 3;
+        memcpy(out, indices + cluster.begin * 3, count * sizeof(uint32_t));
+        out += count;
+    }
+}
+
+uint32_t mesh::optimizeVertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t indexCount, uint32_t vertexCount)
+{
+    std::fill(remap, remap + vertexCount, UnusedVertex);
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        assert(indices[i] < vertexCount);
+        if (remap[indices[i]] == UnusedVertex)
+            remap[indices[i]] = next++;
+    }
+    return next;
+}
+
+void mesh::remapIndices(uint32_t* dst, const uint32_t* indices, size_t indexCount, const uint32_t* remap)
+{
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        assert(remap[indices[i]] != UnusedVertex);
+        dst[i] = remap[indices[i]];
+    }
+}
+
+void mesh::remapVertices(void* dst, const void* vertices, uint32_t vertexCount, uint32_t vertexSize, const uint32_t* remap)
+{
+    assert(dst != vertices);
+
+    auto out = static_cast<uint8_t*>(dst);
+    auto in = static_cast<const uint8_t*>(vertices);
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        if (remap[v] != UnusedVertex)
+            memcpy(out + static_cast<size_t>(remap[v]) * vertexSize, in + static_cast<size_t>(v) * vertexSize, vertexSize);
+    }
+}
+
+bool mesh::fitsUint16(const uint32_t* indices, size_t indexCount)
+{
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        if (indices[i] > 0xFFFF)
+            return false;
+    }
+    return true;
+}
+
+mesh::OptimizeStatistics mesh::optimize(Mesh& mesh, const OptimizeSettings& settings)
+{
+    OptimizeStatistics statistics;
+    const size_t indexCount = mesh.indices.size();
+    if (indexCount == 0 || mesh.attributes.empty())
+        return statistics;
+
+    uint32_t vertexSize = 0;
+    for (const auto& attribute : mesh.attributes)
+    {
+        assert(attribute.data.size() == static_cast<size_t>(mesh.vertexCount) * attribute.componentCount);
+        vertexSize += attribute.componentCount * sizeof(float);
+    }
+
+    statistics.cacheBefore = analyzeVertexCache(mesh.indices.data(), indexCount, mesh.vertexCount);
+    statistics.fetchBefore = analyzeVertexFetch(mesh.indices.data(), indexCount, mesh.vertexCount, vertexSize);
+
+    std::vector<uint32_t> indices(indexCount);
+    optimizeVertexCache(indices.data(), mesh.indices.data(), indexCount, mesh.vertexCount);
+
+    if (settings.overdraw)
+    {
+        assert(settings.positionAttribute < mesh.attributes.size());
+        const auto& positions = mesh.attributes[settings.positionAttribute];
+        optimizeOverdraw(mesh.indices.data(), indices.data(), indexCount, positions.data.data(), positions.componentCount,
+            positions.componentCount, mesh.vertexCount, settings.overdrawThreshold);
+    }
+    else
+    {
+        mesh.indices.swap(indices);
+    }
+
+    std::vector<uint32_t> remap(mesh.vertexCount);
+    const uint32_t vertexCount = optimizeVertexFetchRemap(remap.data(), mesh.indices.data(), indexCount, mesh.vertexCount);
+    remapIndices(mesh.indices.data(), mesh.indices.data(), indexCount, remap.data());
+
+    for (auto& attribute : mesh.attributes)
+    {
+        std::vector<float> data(static_cast<size_t>(vertexCount) * attribute.componentCount);
+        remapVertices(data.data(), attribute.data.data(), mesh.vertexCount, attribute.componentCount * sizeof(float), remap.data());
+        attribute.data.swap(data);
+    }
+
+    statistics.removedVertices = mesh.vertexCount - vertexCount;
+    mesh.vertexCount = vertexCount;
+
+    statistics.cacheAfter = analyzeVertexCache(mesh.indices.data(), indexCount, mesh.vertexCount);
+    statistics.fetchAfter = analyzeVertexFetch(mesh.indices.data(), indexCount, mesh.vertexCount, vertexSize);
+    return statistics;
+}
+
+bool mesh::save(const Mesh& mesh, const std::string& filename)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Could not write " << filename << std::endl;
+        return false;
+    }
+
+    const bool uint16 = fitsUint16(mesh.indices.data(), mesh.indices.size());
+
+    file.write(FileMagic, sizeof(FileMagic));
+    writeValue(file, FileVersion);
+    writeValue(file, mesh.vertexCount);
+    writeValue(file, static_cast<uint32_t>(mesh.indices.size()));
+    writeValue(file, static_cast<uint32_t>(uint16 ? sizeof(uint16_t) : sizeof(uint32_t)));
+    writeValue(file, static_cast<uint32_t>(mesh.attributes.size()));
+
+    for (const auto& attribute : mesh.attributes)
+    {
+        writeValue(file, attribute.location);
+        writeValue(file, attribute.componentCount);
+        file.write(reinterpret_cast<const char*>(attribute.data.data()), attribute.data.size() * sizeof(float));
+    }
+
+    if (uint16)
+    {
+        std::vector<uint16_t> indices(mesh.indices.begin(), mesh.indices.end());
+        file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint16_t));
+    }
+    else
+    {
+        file.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(uint32_t));
+    }
+
+    return static_cast<bool>(file);
+}
+
+bool mesh::load(Mesh& mesh, const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    char magic[4];
+    uint32_t version = 0, vertexCount = 0, indexCount = 0, indexSize = 0, attributeCount = 0;
+    if (!file.read(magic, sizeof(magic)) || memcmp(magic, FileMagic, sizeof(magic)) != 0 ||
+        !readValue(file, version) || version != FileVersion ||
+        !readValue(file, vertexCount) || !readValue(file, indexCount) || !readValue(file, indexSize) || !readValue(file, attributeCount) ||
+        (indexSize != sizeof(uint16_t) && indexSize != sizeof(uint32_t)))
+    {
+        std::cout << "Could not read mesh " << filename << std::endl;
+        return false;
+    }
+
+    mesh = Mesh();
+    mesh.vertexCount = vertexCount;
+    mesh.attributes.resize(attributeCount);
+    for (auto& attribute : mesh.attributes)
+    {
+        if (!readValue(file, attribute.location) || !readValue(file, attribute.componentCount) || attribute.componentCount > 4)
+        {
+            std::cout << "Could not read mesh " << filename << std::endl;
+            return false;
+        }
+
+        attribute.data.resize(static_cast<size_t>(vertexCount) * attribute.componentCount);
+        file.read(reinterpret_cast<char*>(attribute.data.data()), attribute.data.size() * sizeof(float));
+    }
+
+    mesh.indices.resize(indexCount);
+    if (indexSize == sizeof(uint16_t))
+    {
+        std::vector<uint16_t> indices(indexCount);
+        file.read(reinterpret_cast<char*>(indices.data()), indices.size() * sizeof(uint16_t));
+        std::copy(indices.begin(), indices.end(), mesh.indices.begin());
+    }
+    else
+    {
+        file.read(reinterpret_cast<char*>(mesh.indices.data()), mesh.indices.size() * sizeof(uint32_t));
+    }
+
+    if (!file)
+    {
+        std::cout << "Mesh " << filename << " is truncated" << std::endl;
+        return false;
+    }
+    return true;
+}
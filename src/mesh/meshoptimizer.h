@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// CPU processing of indexed triangle lists before they are uploaded, shared by the renderers and the offline mesh tool.
+// Triangles are reordered for the post-transform vertex cache (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+// and then in clusters for less overdraw (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"),
+// finally the vertices are renumbered in the order the triangles fetch them.
+// Works on indices only and needs no Vulkan, vertex data is remapped per attribute.
+namespace mesh
+{
+    // Planar float attributes and a triangle list, the layout VertexBuffer::AttributeDescription takes
+    struct Mesh
+    {
+        struct Attribute
+        {
+            uint32_t location = 0;
+            uint32_t componentCount = 0;
+            // vertexCount * componentCount floats
+            std::vector<float> data;
+        };
+
+        std::vector<Attribute> attributes;
+        std::vector<uint32_t> indices;
+        uint32_t vertexCount = 0;
+    };
+
+    // Post-transform vertex cache simulated as a FIFO, the model most GPUs come close to
+    struct CacheStatistics
+    {
+        uint32_t transformedVertices = 0;
+        // average cache miss ratio, transformed vertices per triangle: 3 is the worst, 0.5 the limit for large regular meshes
+        float acmr = 0.0f;
+        // average transform to vertex ratio, transformed vertices per vertex: 1 is optimal
+        float atvr = 0.0f;
+    };
+
+    // Vertex fetch through a small direct mapped cache of 64 byte lines
+    struct FetchStatistics
+    {
+        uint64_t bytesFetched = 0;
+        // bytes fetched per byte of vertex data, 1 is optimal
+        float overfetch = 0.0f;
+    };
+
+    struct OptimizeSettings
+    {
+        // index into Mesh::attributes of the positions the overdraw order is computed from, 2 or 3 components
+        uint32_t positionAttribute = 0;
+        bool overdraw = true;
+        // how much worse than the vertex cache order the ACMR may get to split the mesh into more clusters for overdraw
+        float overdrawThreshold = 1.05f;
+    };
+
+    struct OptimizeStatistics
+    {
+        CacheStatistics cacheBefore;
+        CacheStatistics cacheAfter;
+        FetchStatistics fetchBefore;
+        FetchStatistics fetchAfter;
+        // vertices no triangle referenced, removed by the fetch remap
+        uint32_t removedVertices = 0;
+    };
+
+    const uint32_t DefaultCacheSize = 16;
+
+    // Runs all passes in place: vertex cache, overdraw if enabled, vertex fetch
+    OptimizeStatistics optimize(Mesh& mesh, const OptimizeSettings& settings = OptimizeSettings());
+
+    CacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = DefaultCacheSize);
+    FetchStatistics analyzeVertexFetch(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t vertexSize);
+
+    // dst must not alias indices
+    void optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+    // indices should be in vertex cache order. positions has positionStride floats per vertex, of which the first
+    // componentCount are used. dst must not alias indices.
+    void optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, uint32_t positionStride,
+        uint32_t componentCount, uint32_t vertexCount, float threshold);
+
+    // Numbers the vertices in the order the indices first reference them, unreferenced vertices map to UnusedVertex.
+    // Returns the number of referenced vertices.
+    const uint32_t UnusedVertex = ~0u;
+    uint32_t optimizeVertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+    void remapIndices(uint32_t* dst, const uint32_t* indices, size_t indexCount, const uint32_t* remap);
+    // dst holds the referenced vertices of vertexSize bytes each
+    void remapVertices(void* dst, const void* vertices, uint32_t vertexCount, uint32_t vertexSize, const uint32_t* remap);
+
+    // 16 bit indices halve the index buffer when every index fits
+    bool fitsUint16(const uint32_t* indices, size_t indexCount);
+
+    // Binary mesh files written by the mesh tool, indices are stored as 16 bit when they fit
+    bool save(const Mesh& mesh, const std::string& filename);
+    bool load(Mesh& mesh, const std::string& filename);
+}
@@ -1,10 +1,16 @@
 #include "simplerenderer.h"
 #include "vulkan/vulkanhelper.h"
+#include "vulkan/uploadbatch.h"
 
 bool SimpleRenderer::setup()
 {
     m_shader.createFromFiles(m_device.getVkDevice(), "data/shaders/simple.vert.spv", "data/shaders/simple.frag.spv");
-    m_texture.loadFromFile(&m_device, "data/textures/vulkan.jpg");
+
+    // all uploads of the scene go to the GPU with a single submission
+    UploadBatch uploadBatch;
+    uploadBatch.begin(&m_device);
+
+    m_texture.loadFromFile(&m_device, "data/textures/vulkan.jpg", &uploadBatch);
 
     m_device.createSampler(m_sampler);
 
@@ -43,24 +49,28 @@ bool SimpleRenderer::setup()
 
     const uint16_t indices[] = { 0, 1, 2, 2, 3, 0 };
 
-    m_vertexBuffer.init(&m_device, attribDesc);
-    m_vertexBuffer.setIndices(indices, 6);
+    m_vertexBuffer.init(&m_device, attribDesc, &uploadBatch);
+    m_vertexBuffer.setIndices(indices, 6, &uploadBatch);
+
+    uploadBatch.submit();
 
     PipelineSettings settings;
 
-    m_pipeline.init(m_device.getVkDevice(),
+    m_pipeline.init(&m_device,
         m_renderPass.getVkRenderPass(),
         m_pipelineLayout.getVkPipelineLayout(),
         settings,
         m_shader.getShaderStages(),
         &m_vertexBuffer);
 
+    uploadBatch.wait();
+
     return true;
 }
 
 void SimpleRenderer::shutdown()
 {
-    m_descriptorSet.destroy(m_device.getVkDevice());
+    m_descriptorSet.destroy(&m_device);
     m_shader.destory();
     m_vertexBuffer.destroy();
     m_pipeline.destroy();
@@ -78,6 +88,8 @@ void SimpleRenderer::fillCommandBuffers()
         beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 
         VK_CHECK_RESULT(vkBeginCommandBuffer(m_commandBuffers[i], &beginInfo));
+        m_gpuProfiler.beginFrame(m_commandBuffers[i], static_cast<uint32_t>(i));
+        m_gpuProfiler.beginScope(m_commandBuffers[i], "frame");
 
         VkRenderPassBeginInfo renderPassInfo = {};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -101,9 +113,12 @@ void SimpleRenderer::fillCommandBuffers()
 
         m_descriptorSet.bind(m_commandBuffers[i], m_pipelineLayout.getVkPipelineLayout());
 
+        m_gpuProfiler.beginScope(m_commandBuffers[i], "quad");
         m_vertexBuffer.draw(m_commandBuffers[i]);
+        m_gpuProfiler.endScope(m_commandBuffers[i]);
 
         vkCmdEndRenderPass(m_commandBuffers[i]);
+        m_gpuProfiler.endScope(m_commandBuffers[i]);
 
         VK_CHECK_RESULT(vkEndCommandBuffer(m_commandBuffers[i]));
     }
@@ -0,0 +1,257 @@
+#include "mesh/meshoptimizer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Converts a Wavefront OBJ file into an optimized binary mesh that mesh::load reads back.
+// Faces are triangulated, vertices deduplicated, and the result runs through the same optimizer as meshes built in memory:
+//   myVulkanMeshTool model.obj model.mesh
+// Attributes: location 0 positions (3 floats), 1 texture coordinates (2) and 2 normals (3) if the file has them.
+
+namespace
+{
+    struct Options
+    {
+        std::string input;
+        std::string output;
+        mesh::OptimizeSettings settings;
+    };
+
+    void printUsage()
+    {
+        std::cout << "Usage: myVulkanMeshTool [options] input.obj output.mesh\n"
+            << "  --overdraw N       0 skips the overdraw pass (1)\n"
+            << "  --threshold F      ACMR the overdraw pass may add, relative to the vertex cache order (1.05)" << std::endl;
+    }
+
+    bool parseOptions(int argc, char* argv[], Options& options)
+    {
+        std::vector<std::string> files;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0)
+            {
+                files.push_back(arg);
+                continue;
+            }
+
+            if (i + 1 >= argc)
+                return false;
+
+            const char* value = argv[++i];
+            if (arg == "--overdraw")
+                options.settings.overdraw = std::atoi(value) != 0;
+            else if (arg == "--threshold")
+                options.settings.overdrawThreshold = static_cast<float>(std::atof(value));
+            else
+                return false;
+        }
+
+        if (files.size() != 2)
+            return false;
+
+        options.input = files[0];
+        options.output = files[1];
+        return true;
+    }
+
+    struct VertexKey
+    {
+        int position;
+        int texCoord;
+        int normal;
+
+        bool operator==(const VertexKey& other) const
+        {
+            return position == other.position && texCoord == other.texCoord && normal == other.normal;
+        }
+    };
+
+    struct VertexKeyHash
+    {
+        size_t operator()(const VertexKey& key) const
+        {
+            return (static_cast<size_t>(key.position) * 73856093u) ^ (static_cast<size_t>(key.texCoord) * 19349663u) ^ (static_cast<size_t>(key.normal) * 83492791u);
+        }
+    };
+
+    // OBJ indices start at 1, negative ones count back from the last element read so far. Returns -1 for missing indices.
+    int resolveIndex(const std::string& token, size_t count)
+    {
+        if (token.empty())
+            return -1;
+
+        const int index = std::atoi(token.c_str());
+        if (index > 0 && static_cast<size_t>(index) <= count)
+            return index - 1;
+        if (index < 0 && static_cast<size_t>(-index) <= count)
+            return static_cast<int>(count) + index;
+        return -2;
+    }
+
+    bool loadObj(const std::string& filename, mesh::Mesh& result)
+    {
+        std::ifstream file(filename);
+        if (!file)
+        {
+            std::cout << "Could not open " << filename << std::endl;
+            return false;
+        }
+
+        std::vector<float> positions;
+        std::vector<float> texCoords;
+        std::vector<float> normals;
+        std::vector<VertexKey> vertices;
+        std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertexIndices;
+        std::vector<uint32_t> indices;
+
+        std::string line;
+        uint32_t lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            ++lineNumber;
+            std::istringstream stream(line);
+            std::string type;
+            stream >> type;
+
+            if (type == "v")
+            {
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                stream >> x >> y >> z;
+                positions.insert(positions.end(), { x, y, z });
+            }
+            else if (type == "vt")
+            {
+                float u = 0.0f, v = 0.0f;
+                stream >> u >> v;
+                // OBJ has the origin at the bottom left, Vulkan samples from the top left
+                texCoords.insert(texCoords.end(), { u, 1.0f - v });
+            }
+            else if (type == "vn")
+            {
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                stream >> x >> y >> z;
+                normals.insert(normals.end(), { x, y, z });
+            }
+            else if (type == "f")
+            {
+                std::vector<uint32_t> face;
+                std::string corner;
+                while (stream >> corner)
+                {
+                    // v, v/vt, v//vn or v/vt/vn
+                    std::string parts[3];
+                    size_t part = 0;
+                    for (char c : corner)
+                    {
+                        if (c == '/')
+                            part = std::min<size_t>(part + 1, 2);
+                        else
+                            parts[part] += c;
+                    }
+
+                    const VertexKey key = { resolveIndex(parts[0], positions.size() / 3), resolveIndex(parts[1], texCoords.size() / 2), resolveIndex(parts[2], normals.size() / 3) };
+                    if (key.position < 0 || key.texCoord == -2 || key.normal == -2)
+                    {
+                        std::cout << filename << ":" << lineNumber << ": invalid face index" << std::endl;
+                        return false;
+                    }
+
+                    auto it = vertexIndices.find(key);
+                    if (it == vertexIndices.end())
+                    {
+                        it = vertexIndices.emplace(key, static_cast<uint32_t>(vertices.size())).first;
+                        vertices.push_back(key);
+                    }
+                    face.push_back(it->second);
+                }
+
+                // polygons are assumed convex and split into a fan
+                for (size_t i = 2; i < face.size(); ++i)
+                {
+                    indices.insert(indices.end(), { face[0], face[i - 1], face[i] });
+                }
+            }
+        }
+
+        if (indices.empty())
+        {
+            std::cout << filename << " has no faces" << std::endl;
+            return false;
+        }
+
+        bool hasTexCoords = false;
+        bool hasNormals = false;
+        for (const VertexKey& key : vertices)
+        {
+            hasTexCoords |= key.texCoord >= 0;
+            hasNormals |= key.normal >= 0;
+        }
+
+        result = mesh::Mesh();
+        result.vertexCount = static_cast<uint32_t>(vertices.size());
+        result.indices.swap(indices);
+
+        mesh::Mesh::Attribute position = { 0, 3, {} };
+        mesh::Mesh::Attribute texCoord = { 1, 2, {} };
+        mesh::Mesh::Attribute normal = { 2, 3, {} };
+        for (const VertexKey& key : vertices)
+        {
+            position.data.insert(position.data.end(), positions.begin() + key.position * 3, positions.begin() + key.position * 3 + 3);
+            if (hasTexCoords)
+            {
+                if (key.texCoord >= 0)
+                    texCoord.data.insert(texCoord.data.end(), texCoords.begin() + key.texCoord * 2, texCoords.begin() + key.texCoord * 2 + 2);
+                else
+                    texCoord.data.insert(texCoord.data.end(), { 0.0f, 0.0f });
+            }
+            if (hasNormals)
+            {
+                if (key.normal >= 0)
+                    normal.data.insert(normal.data.end(), normals.begin() + key.normal * 3, normals.begin() + key.normal * 3 + 3);
+                else
+                    normal.data.insert(normal.data.end(), { 0.0f, 0.0f, 0.0f });
+            }
+        }
+
+        result.attributes.push_back(std::move(position));
+        if (hasTexCoords)
+            result.attributes.push_back(std::move(texCoord));
+        if (hasNormals)
+            result.attributes.push_back(std::move(normal));
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    mesh::Mesh result;
+    if (!loadObj(options.input, result))
+        return 1;
+
+    const mesh::OptimizeStatistics statistics = mesh::optimize(result, options.settings);
+
+    std::cout << options.input << ": " << result.indices.size() / 3 << " triangles, " << result.vertexCount << " vertices";
+    if (statistics.removedVertices > 0)
+        std::cout << " (" << statistics.removedVertices << " unused removed)";
+    std::cout << "\n  ACMR " << statistics.cacheBefore.acmr << " -> " << statistics.cacheAfter.acmr
+        << "\n  ATVR " << statistics.cacheBefore.atvr << " -> " << statistics.cacheAfter.atvr
+        << "\n  overfetch " << statistics.fetchBefore.overfetch << " -> " << statistics.fetchAfter.overfetch
+        << "\n  indices " << (mesh::fitsUint16(result.indices.data(), result.indices.size()) ? "16" : "32") << " bit" << std::endl;
+
+    return mesh::save(result, options.output) ? 0 : 1;
+}
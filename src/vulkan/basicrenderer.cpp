@@ -1,9 +1,13 @@
 #include "basicrenderer.h"
 #include "vulkanhelper.h"
 #include "debug.h"
+#include "trace.h"
+#include "readbackbuffer.h"
+#include "uploadbatch.h"
 
 #include <SDL_vulkan.h>
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 
@@ -13,36 +17,91 @@ const bool enableValidationLayers = false;
 const bool enableValidationLayers = true;
 #endif
 
-bool BasicRenderer::init(SDL_Window* window)
+bool BasicRenderer::init(SDL_Window* window, PresentPolicy presentPolicy)
 {
-    createInstance(window);
+    TRACE_ZONE("BasicRenderer::init");
+
+    if (!createInstance(window))
+        return false;
 
     SDL_Vulkan_CreateSurface(window, m_instance, &m_surface);
 
-    createDevice();
-    createSwapChain(window);
-    m_renderPass.init(m_device.getVkDevice(), m_swapChain.getImageFormat());
+    if (!createDevice())
+        return false;
+
+    m_swapChain.setPresentPolicy(presentPolicy);
+    if (!createSwapChain(window))
+        return false;
+
+    if (!createResources(SwapChain::getFramesInFlight(presentPolicy)))
+        return false;
+
+    printPresentSettings();
+    return true;
+}
+
+bool BasicRenderer::initHeadless(uint32_t width, uint32_t height, uint32_t framesInFlight)
+{
+    TRACE_ZONE("BasicRenderer::init");
+
+    if (!createInstance(nullptr))
+        return false;
+
+    if (!createDevice())
+        return false;
 
-    if (!setup())
+    m_swapChain.initHeadless(m_device);
+    if (!m_swapChain.create(width, height))
         return false;
 
+    if (!createResources(framesInFlight))
+        return false;
+
+    printPresentSettings();
+    return true;
+}
+
+bool BasicRenderer::createResources(uint32_t framesInFlight)
+{
+    // offscreen images are not presented, leave them ready to be copied from instead
+    const VkImageLayout finalLayout = m_swapChain.isHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    m_renderPass.init(m_device.getVkDevice(), m_swapChain.getImageFormat(), finalLayout);
+
+    // the frame data exists before setup so renderers can size per frame resources
+    createFrameData(framesInFlight);
+    m_gpuProfiler.init(&m_device, getGpuProfilerSlotCount());
+
+    {
+        TRACE_ZONE("setup");
+        if (!setup())
+            return false;
+    }
+
     createCommandBuffers();
     createSwapChainFramebuffers();
 
     fillCommandBuffers();
-    
+
+    m_lastFrameTimePoint = std::chrono::high_resolution_clock::now();
+    m_averageStartTimePoint = m_lastFrameTimePoint;
+
     return true;
 }
 
 bool BasicRenderer::createInstance(SDL_Window* window)
 {
-    uint32_t extensionCount(0);
-    if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, nullptr))
-        return false;
+    // a headless renderer has no window and doesn't need any surface extensions
+    std::vector<const char*> extensions;
+    if (window)
+    {
+        uint32_t extensionCount(0);
+        if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, nullptr))
+            return false;
 
-    std::vector<const char*> extensions(extensionCount);
-    if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, &extensions[0]))
-        return false;
+        extensions.resize(extensionCount);
+        if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, &extensions[0]))
+            return false;
+    }
 
     if (enableValidationLayers)
     {
@@ -61,7 +120,7 @@ bool BasicRenderer::createInstance(SDL_Window* window)
     instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     instanceCreateInfo.pApplicationInfo = &appInfo;
     instanceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
-    instanceCreateInfo.ppEnabledExtensionNames = &extensions[0];
+    instanceCreateInfo.ppEnabledExtensionNames = extensions.data();
     if (enableValidationLayers)
     {
         instanceCreateInfo.enabledLayerCount = debug::validationLayerCount;
@@ -115,7 +174,7 @@ bool BasicRenderer::createSwapChainFramebuffers()
     for (size_t i = 0; i < m_commandBuffers.size(); i++)
     {
         m_framebuffers[i].init(
-            m_device.getVkDevice(),
+            &m_device,
             m_renderPass.getVkRenderPass(),
             m_swapChain.getImageView(static_cast<uint32_t>(i)),
             m_swapChain.getImageExtent());
@@ -124,6 +183,56 @@ bool BasicRenderer::createSwapChainFramebuffers()
     return true;
 }
 
+bool BasicRenderer::createFrameData(uint32_t framesInFlight)
+{
+    assert(framesInFlight > 0);
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    // Fences start signaled so the first wait of each frame returns immediately
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m_device.getGraphicsQueueFamilyIndex();
+
+    m_frames.resize(framesInFlight);
+    for (auto& frame : m_frames)
+    {
+        VK_CHECK_RESULT(vkCreateFence(m_device.getVkDevice(), &fenceInfo, nullptr, &frame.fence));
+        VK_CHECK_RESULT(vkCreateSemaphore(m_device.getVkDevice(), &semaphoreInfo, nullptr, &frame.imageAvailableSemaphore));
+        VK_CHECK_RESULT(vkCreateSemaphore(m_device.getVkDevice(), &semaphoreInfo, nullptr, &frame.renderFinishedSemaphore));
+
+        if (recordsEveryFrame())
+        {
+            VK_CHECK_RESULT(vkCreateCommandPool(m_device.getVkDevice(), &poolInfo, nullptr, &frame.commandPool));
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = frame.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+
+            VK_CHECK_RESULT(vkAllocateCommandBuffers(m_device.getVkDevice(), &allocInfo, &frame.commandBuffer));
+        }
+    }
+    m_currentFrame = 0;
+
+    if (recordsEveryFrame())
+    {
+        m_commandRecorder.init(&m_device, framesInFlight);
+        m_frameArena.init(&m_device, framesInFlight);
+    }
+
+    m_imagesInFlight.assign(m_swapChain.getImageCount(), VK_NULL_HANDLE);
+
+    return true;
+}
+
 void BasicRenderer::destroy()
 {
     // wait to avoid destruction of still used resources
@@ -132,12 +241,17 @@ void BasicRenderer::destroy()
     m_renderPass.destroy();
     destroyFramebuffers();
     destroyCommandBuffers();
+    destroyFrameData();
+    m_gpuProfiler.destroy();
     m_swapChain.destroy();
 
     shutdown();
 
     m_device.destroy();
-    vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    if (m_surface != VK_NULL_HANDLE)
+    {
+        vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    }
 
     if (enableValidationLayers)
     {
@@ -148,14 +262,22 @@ void BasicRenderer::destroy()
 
 bool BasicRenderer::resize(uint32_t width, uint32_t height)
 {
-    vkDeviceWaitIdle(m_device.getVkDevice());
+    TRACE_ZONE("BasicRenderer::resize");
 
+    // the new swap chain is used right away, the old one, its framebuffers and the command buffers
+    // recorded for them are retired through the deletion queue once the frames in flight completed
     if (m_swapChain.create(width, height))
     {
         destroyFramebuffers();
-        destroyCommandBuffers();
+        m_device.getDeletionQueue().freeCommandBuffers(m_device.getCommandPool(), m_commandBuffers);
         createCommandBuffers();
         createSwapChainFramebuffers();
+        // the image count may have changed, every image needs its profiler slot before it is recorded
+        m_gpuProfiler.resize(getGpuProfilerSlotCount());
+
+        // the new images were never rendered to, the frame fences still guard everything in flight
+        m_imagesInFlight.assign(m_swapChain.getImageCount(), VK_NULL_HANDLE);
+        m_lastImageId = UINT32_MAX;
 
         fillCommandBuffers();
         return true;
@@ -163,6 +285,58 @@ bool BasicRenderer::resize(uint32_t width, uint32_t height)
     return false;
 }
 
+bool BasicRenderer::setPresentPolicy(PresentPolicy presentPolicy)
+{
+    if (presentPolicy == m_swapChain.getPresentPolicy())
+        return true;
+
+    m_swapChain.setPresentPolicy(presentPolicy);
+
+    const uint32_t framesInFlight = SwapChain::getFramesInFlight(presentPolicy);
+    const bool framesInFlightChanged = framesInFlight != getFramesInFlight();
+    if (framesInFlightChanged)
+    {
+        // the ring is rebuilt, its semaphores may still be waited on by presentation,
+        // so this is the one change that idles the device
+        vkDeviceWaitIdle(m_device.getVkDevice());
+        m_device.getDeletionQueue().flush();
+
+        destroyFrameData();
+        createFrameData(framesInFlight);
+    }
+
+    bool result = true;
+    if (!m_swapChain.isHeadless())
+    {
+        // resizes the profiler for the new image count as well
+        result = resize(m_swapChain.getImageExtent().width, m_swapChain.getImageExtent().height);
+    }
+    else if (framesInFlightChanged)
+    {
+        // offscreen images aren't presented, only the number of frames in flight changed.
+        // The device is idle, the per image command buffers are recorded again for the resized profiler.
+        m_gpuProfiler.resize(getGpuProfilerSlotCount());
+        destroyCommandBuffers();
+        createCommandBuffers();
+        fillCommandBuffers();
+    }
+
+    printPresentSettings();
+    return result;
+}
+
+void BasicRenderer::printPresentSettings() const
+{
+    // offscreen rendering isn't presented, the frames in flight are passed to initHeadless or come from the policy
+    if (m_swapChain.isHeadless())
+        std::cout << "Offscreen";
+    else
+        std::cout << "Present policy " << toString(m_swapChain.getPresentPolicy()) << ": " << toString(m_swapChain.getPresentMode());
+
+    std::cout << ", " << m_swapChain.getImageCount() << " images, "
+        << getFramesInFlight() << " frames in flight" << std::endl;
+}
+
 void BasicRenderer::destroyFramebuffers()
 {
     for (auto& framebuffer : m_framebuffers)
@@ -176,36 +350,170 @@ void BasicRenderer::destroyCommandBuffers()
     vkFreeCommandBuffers(m_device.getVkDevice(), m_device.getCommandPool(), static_cast<uint32_t>(m_commandBuffers.size()), m_commandBuffers.data());
 }
 
+void BasicRenderer::destroyFrameData()
+{
+    for (auto& frame : m_frames)
+    {
+        vkDestroyFence(m_device.getVkDevice(), frame.fence, nullptr);
+        vkDestroySemaphore(m_device.getVkDevice(), frame.imageAvailableSemaphore, nullptr);
+        vkDestroySemaphore(m_device.getVkDevice(), frame.renderFinishedSemaphore, nullptr);
+        if (frame.commandPool != VK_NULL_HANDLE)
+        {
+            vkDestroyCommandPool(m_device.getVkDevice(), frame.commandPool, nullptr);
+        }
+    }
+    m_frames.clear();
+
+    if (recordsEveryFrame())
+    {
+        m_commandRecorder.destroy();
+        m_frameArena.destroy();
+    }
+    m_imagesInFlight.clear();
+}
+
 void BasicRenderer::draw()
 {
-    if (enableValidationLayers)
+    trace::beginFrame(m_frameCount);
+    TRACE_ZONE("draw");
+
+    FrameData& frame = m_frames[m_currentFrame];
+    DeletionQueue& deletionQueue = m_device.getDeletionQueue();
+
+    // wait until the GPU finished the frame that last used this slot of the ring,
+    // all other frames in flight keep running while the CPU prepares this one
     {
-        // to avoid memory leak from validation layers
-        vkQueueWaitIdle(m_device.getPresentationQueue());
+        TRACE_ZONE("wait for frame");
+        VK_CHECK_RESULT(vkWaitForFences(m_device.getVkDevice(), 1, &frame.fence, VK_TRUE, UINT64_MAX));
     }
 
+    // frames complete in submission order, so everything up to this one finished as well
+    deletionQueue.collect(frame.deletionFrame);
+
     uint32_t imageId(0);
-    if (!m_swapChain.acquireNextImage(imageId))
+    if (!m_swapChain.acquireNextImage(frame.imageAvailableSemaphore, imageId))
+    {
         resize(m_swapChain.getImageExtent().width, m_swapChain.getImageExtent().height);
+        return;
+    }
+
+    // the swap chain may hand out images out of order, so an older frame could still be rendering to it
+    if (m_imagesInFlight[imageId] != VK_NULL_HANDLE && m_imagesInFlight[imageId] != frame.fence)
+    {
+        TRACE_ZONE("wait for image");
+        VK_CHECK_RESULT(vkWaitForFences(m_device.getVkDevice(), 1, &m_imagesInFlight[imageId], VK_TRUE, UINT64_MAX));
+    }
+    m_imagesInFlight[imageId] = frame.fence;
+
+    // the last submission of the slot finished with one of the fences above, its queries are read before they are reset
+    const uint32_t profilerSlot = recordsEveryFrame() ? m_currentFrame : imageId;
+    m_gpuProfiler.collect(profilerSlot);
+
+    const VkCommandBuffer commandBuffer = recordsEveryFrame() ? recordFrameCommandBuffer(frame, imageId) : m_commandBuffers[imageId];
 
-    submitCommandBuffer(m_commandBuffers[imageId]);
+    VK_CHECK_RESULT(vkResetFences(m_device.getVkDevice(), 1, &frame.fence));
+    submitCommandBuffer(commandBuffer, frame);
+    frame.deletionFrame = deletionQueue.getFrame();
+    deletionQueue.nextFrame();
+    m_gpuProfiler.markSubmitted(profilerSlot);
 
-    if (!m_swapChain.present(imageId))
+    m_currentFrame = (m_currentFrame + 1) % static_cast<uint32_t>(m_frames.size());
+    m_lastImageId = imageId;
+
+    if (!m_swapChain.present(imageId, frame.renderFinishedSemaphore))
         resize(m_swapChain.getImageExtent().width, m_swapChain.getImageExtent().height);
+
+    updateFrameTime();
+}
+
+bool BasicRenderer::readLastFrame(std::vector<uint8_t>& pixels)
+{
+    if (!m_swapChain.isHeadless() || m_lastImageId == UINT32_MAX)
+        return false;
+
+    TRACE_ZONE("readLastFrame");
+
+    // offscreen images are RGBA8
+    const VkExtent2D extent = m_swapChain.getImageExtent();
+    const VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+
+    ReadbackBuffer readback;
+    readback.init(&m_device, size);
+
+    UploadBatch batch;
+    batch.begin(&m_device);
+    const VkCommandBuffer commandBuffer = batch.getGraphicsCommandBuffer();
+
+    // the render pass left the image in TRANSFER_SRC_OPTIMAL, its dependency to VK_SUBPASS_EXTERNAL orders
+    // the layout transition and the writes before this copy on the same queue
+    readback.copyFromImage(commandBuffer, m_swapChain.getImage(m_lastImageId), extent.width, extent.height);
+
+    batch.submit();
+    batch.wait();
+
+    const uint8_t* data = static_cast<const uint8_t*>(readback.read(0, size));
+    pixels.assign(data, data + size);
+
+    readback.destroy();
+    return true;
 }
 
-void BasicRenderer::submitCommandBuffer(VkCommandBuffer commandBuffer)
+VkCommandBuffer BasicRenderer::recordFrameCommandBuffer(const FrameData& frame, uint32_t imageId)
 {
+    TRACE_ZONE("record frame");
+
+    // the fence of this frame signaled, so nothing recorded from its pools is in use anymore
+    VK_CHECK_RESULT(vkResetCommandPool(m_device.getVkDevice(), frame.commandPool, 0));
+    m_commandRecorder.beginFrame(m_currentFrame);
+    m_frameArena.beginFrame(m_currentFrame);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VK_CHECK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+    m_gpuProfiler.beginFrame(frame.commandBuffer, m_currentFrame);
+    m_gpuProfiler.beginScope(frame.commandBuffer, "frame");
+    recordFrame(frame.commandBuffer, imageId);
+    m_gpuProfiler.endScope(frame.commandBuffer);
+    VK_CHECK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+    m_frameArena.endFrame();
+
+    return frame.commandBuffer;
+}
+
+void BasicRenderer::updateFrameTime()
+{
+    const auto now = std::chrono::high_resolution_clock::now();
+    m_frameTime = std::chrono::duration<double, std::milli>(now - m_lastFrameTimePoint).count();
+    m_lastFrameTimePoint = now;
+    m_frameCount++;
+    m_averageFrameCount++;
+
+    const double elapsed = std::chrono::duration<double, std::milli>(now - m_averageStartTimePoint).count();
+    if (elapsed >= 1000.0)
+    {
+        m_averageFrameTime = elapsed / m_averageFrameCount;
+        m_averageFrameCount = 0;
+        m_averageStartTimePoint = now;
+    }
+}
+
+void BasicRenderer::submitCommandBuffer(VkCommandBuffer commandBuffer, const FrameData& frame)
+{
+    // offscreen images are neither acquired nor presented, so there is nothing to wait for or signal
+    const uint32_t semaphoreCount = m_swapChain.isHeadless() ? 0 : 1;
+
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = m_swapChain.getImageAvailableSemaphore();
+    submitInfo.waitSemaphoreCount = semaphoreCount;
+    submitInfo.pWaitSemaphores = &frame.imageAvailableSemaphore;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = m_swapChain.getRenderFinishedSemaphore();
+    submitInfo.signalSemaphoreCount = semaphoreCount;
+    submitInfo.pSignalSemaphores = &frame.renderFinishedSemaphore;
 
-    VK_CHECK_RESULT(vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE));
-}
\ No newline at end of file
+    VK_CHECK_RESULT(vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, frame.fence));
+}
@@ -4,45 +4,122 @@
 #include "device.h"
 #include "framebuffer.h"
 #include "renderpass.h"
+#include "commandrecorder.h"
+#include "gpuprofiler.h"
+#include "framearena.h"
 
 #include <vulkan/vulkan.h>
+#include <algorithm>
+#include <chrono>
 
 struct SDL_Window;
 
 class BasicRenderer
 {
 public:
-    bool init(SDL_Window* window);
+    static const uint32_t DefaultFramesInFlight = 2;
+
+    // The present policy decides the present mode, swap chain image count and frames in flight
+    bool init(SDL_Window* window, PresentPolicy presentPolicy = SwapChain::DefaultPresentPolicy);
+    // Renders into a ring of offscreen images instead of a window surface, works without any display
+    bool initHeadless(uint32_t width, uint32_t height, uint32_t framesInFlight = DefaultFramesInFlight);
     void destroy();
 
     bool resize(uint32_t width, uint32_t height);
 
+    // Switches at runtime, only a different number of frames in flight needs the device to be idle
+    bool setPresentPolicy(PresentPolicy presentPolicy);
+    PresentPolicy getPresentPolicy() const { return m_swapChain.getPresentPolicy(); }
+    VkPresentModeKHR getPresentMode() const { return m_swapChain.getPresentMode(); }
+    uint32_t getSwapChainImageCount() const { return m_swapChain.getImageCount(); }
+
     void draw();
 
+    // CPU time between two consecutive draw() calls in milliseconds
+    double getFrameTime() const { return m_frameTime; }
+    // Frame time averaged over the last second in milliseconds
+    double getAverageFrameTime() const { return m_averageFrameTime; }
+    uint64_t getFrameCount() const { return m_frameCount; }
+    // GPU times of the scopes of the most recently completed frame
+    const GpuProfiler& getGpuProfiler() const { return m_gpuProfiler; }
+
+    // Headless only: copies the most recently drawn image to pixels as tightly packed RGBA8,
+    // waits for the GPU to finish it
+    bool readLastFrame(std::vector<uint8_t>& pixels);
+
 private:
+    // Synchronization objects owned by one frame of the frames-in-flight ring
+    struct FrameData
+    {
+        VkFence fence = VK_NULL_HANDLE;
+        VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+        VkSemaphore renderFinishedSemaphore = VK_NULL_HANDLE;
+        // only used by renderers that record every frame
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        // deletion queue frame that was last submitted from this slot, 0 before the first submission
+        uint64_t deletionFrame = 0;
+    };
+
     bool createInstance(SDL_Window* window);
     bool createDevice();
     bool createSwapChain(SDL_Window* window);
+    bool createResources(uint32_t framesInFlight);
     bool createCommandBuffers();
     bool createSwapChainFramebuffers();
+    bool createFrameData(uint32_t framesInFlight);
+    void printPresentSettings() const;
+    // a slot per frame in flight for renderers that record every frame, per image for prerecorded command buffers
+    uint32_t getGpuProfilerSlotCount() const { return std::max(getFramesInFlight(), m_swapChain.getImageCount()); }
 
     void destroyFramebuffers();
     void destroyCommandBuffers();
+    void destroyFrameData();
 
     bool checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, uint32_t &graphicsQueueNodeIndex);
-    void submitCommandBuffer(VkCommandBuffer commandBuffer);
+    void submitCommandBuffer(VkCommandBuffer commandBuffer, const FrameData& frame);
+    VkCommandBuffer recordFrameCommandBuffer(const FrameData& frame, uint32_t imageId);
+    void updateFrameTime();
 
     virtual bool setup() = 0;
     virtual void shutdown() = 0;
     virtual void fillCommandBuffers() = 0;
 
+    // Renderers that return true record a new command buffer every frame in recordFrame
+    // instead of submitting the per image command buffers filled once by fillCommandBuffers
+    virtual bool recordsEveryFrame() const { return false; }
+    virtual void recordFrame(VkCommandBuffer /*commandBuffer*/, uint32_t /*imageId*/) {}
+
     VkInstance m_instance = VK_NULL_HANDLE;
     VkSurfaceKHR m_surface = VK_NULL_HANDLE;
 
+    std::vector<FrameData> m_frames;
+    std::vector<VkFence> m_imagesInFlight;
+    uint32_t m_currentFrame = 0;
+    uint32_t m_lastImageId = UINT32_MAX;
+
+    std::chrono::high_resolution_clock::time_point m_lastFrameTimePoint;
+    std::chrono::high_resolution_clock::time_point m_averageStartTimePoint;
+    uint32_t m_averageFrameCount = 0;
+    uint64_t m_frameCount = 0;
+    double m_frameTime = 0.0;
+    double m_averageFrameTime = 0.0;
+
 protected:
+    // Index into the frames-in-flight ring of the frame that is being recorded or submitted next
+    uint32_t getCurrentFrame() const { return m_currentFrame; }
+    uint32_t getFramesInFlight() const { return static_cast<uint32_t>(m_frames.size()); }
+
     Device m_device;
     SwapChain m_swapChain;
     RenderPass m_renderPass;
     std::vector<VkCommandBuffer> m_commandBuffers;
     std::vector<Framebuffer> m_framebuffers;
+    // records secondary command buffers on worker threads, its pools are reset every frame before recordFrame
+    CommandRecorder m_commandRecorder;
+    // per frame dynamic data for renderers that record every frame, reset before recordFrame and flushed after it
+    FrameArena m_frameArena;
+    // has a slot per frame in flight for renderers that record every frame and one per image otherwise.
+    // recordFrame is already wrapped into a "frame" scope, fillCommandBuffers has to call beginFrame itself.
+    GpuProfiler m_gpuProfiler;
 };
\ No newline at end of file
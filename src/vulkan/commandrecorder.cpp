@@ -0,0 +1,205 @@
+#include "commandrecorder.h"
+#include "vulkanhelper.h"
+#include "device.h"
+#include "trace.h"
+
+#include <algorithm>
+
+void CommandRecorder::init(Device* device, uint32_t framesInFlight, uint32_t threadCount)
+{
+    m_device = device;
+    m_threadCount = threadCount > 0 ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    m_currentFrame = 0;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m_device->getGraphicsQueueFamilyIndex();
+
+    m_pools.resize(framesInFlight * m_threadCount);
+    for (auto& pool : m_pools)
+    {
+        VK_CHECK_RESULT(vkCreateCommandPool(m_device->getVkDevice(), &poolInfo, nullptr, &pool.commandPool));
+    }
+
+    m_recordedCommandBuffers.resize(m_threadCount);
+
+    // the recorder may be initialised again after destroy(), new workers must not see the last job as pending
+    m_quit = false;
+    m_generation = 0;
+    m_busyWorkers = 0;
+    m_taskCount = 0;
+    m_recordFunc = nullptr;
+    for (uint32_t i = 1; i < m_threadCount; ++i)
+    {
+        m_workers.emplace_back(&CommandRecorder::workerLoop, this, i);
+    }
+}
+
+void CommandRecorder::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_workAvailable.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+    m_workers.clear();
+
+    // destroying a pool frees its command buffers
+    for (auto& pool : m_pools)
+    {
+        vkDestroyCommandPool(m_device->getVkDevice(), pool.commandPool, nullptr);
+    }
+    m_pools.clear();
+}
+
+void CommandRecorder::beginFrame(uint32_t frame)
+{
+    assert(frame * m_threadCount < m_pools.size());
+
+    m_currentFrame = frame;
+    for (uint32_t i = 0; i < m_threadCount; ++i)
+    {
+        ThreadCommandPool& pool = m_pools[m_currentFrame * m_threadCount + i];
+        VK_CHECK_RESULT(vkResetCommandPool(m_device->getVkDevice(), pool.commandPool, 0));
+        pool.usedCount = 0;
+    }
+}
+
+void CommandRecorder::record(VkCommandBuffer primaryCommandBuffer, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer,
+    uint32_t taskCount, const RecordFunc& recordFunc)
+{
+    m_recordFunc = &recordFunc;
+    m_taskCount = taskCount;
+
+    m_inheritanceInfo = {};
+    m_inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    m_inheritanceInfo.renderPass = renderPass;
+    m_inheritanceInfo.subpass = subpass;
+    m_inheritanceInfo.framebuffer = framebuffer;
+
+    // a handful of tasks isn't worth waking up the workers for
+    const bool parallel = m_threadCount > 1 && taskCount >= m_threadCount;
+    if (parallel)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busyWorkers = m_threadCount - 1;
+            ++m_generation;
+        }
+        m_workAvailable.notify_all();
+
+        recordRange(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_workDone.wait(lock, [this]() { return m_busyWorkers == 0; });
+    }
+    else
+    {
+        std::fill(m_recordedCommandBuffers.begin(), m_recordedCommandBuffers.end(), static_cast<VkCommandBuffer>(VK_NULL_HANDLE));
+
+        ThreadCommandPool& pool = m_pools[m_currentFrame * m_threadCount];
+        VkCommandBuffer commandBuffer = nextCommandBuffer(pool);
+        recordFunc(commandBuffer, 0, taskCount);
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+        m_recordedCommandBuffers[0] = commandBuffer;
+    }
+
+    // ranges are executed in task order, no matter which thread finished first
+    std::vector<VkCommandBuffer> commandBuffers;
+    for (auto commandBuffer : m_recordedCommandBuffers)
+    {
+        if (commandBuffer != VK_NULL_HANDLE)
+            commandBuffers.push_back(commandBuffer);
+    }
+
+    if (!commandBuffers.empty())
+    {
+        vkCmdExecuteCommands(primaryCommandBuffer, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    }
+
+    m_recordFunc = nullptr;
+}
+
+void CommandRecorder::workerLoop(uint32_t threadIndex)
+{
+    trace::setThreadName("CommandRecorder worker " + std::to_string(threadIndex));
+
+    uint64_t generation = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_workAvailable.wait(lock, [this, generation]() { return m_quit || m_generation != generation; });
+            if (m_quit)
+                return;
+            generation = m_generation;
+        }
+
+        recordRange(threadIndex);
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            done = --m_busyWorkers == 0;
+        }
+        if (done)
+        {
+            m_workDone.notify_one();
+        }
+    }
+}
+
+void CommandRecorder::recordRange(uint32_t threadIndex)
+{
+    const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(m_taskCount) * threadIndex / m_threadCount);
+    const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(m_taskCount) * (threadIndex + 1) / m_threadCount);
+
+    if (begin == end)
+    {
+        m_recordedCommandBuffers[threadIndex] = VK_NULL_HANDLE;
+        return;
+    }
+
+    TRACE_ZONE("CommandRecorder::recordRange");
+
+    ThreadCommandPool& pool = m_pools[m_currentFrame * m_threadCount + threadIndex];
+    VkCommandBuffer commandBuffer = nextCommandBuffer(pool);
+
+    (*m_recordFunc)(commandBuffer, begin, end);
+
+    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+    m_recordedCommandBuffers[threadIndex] = commandBuffer;
+}
+
+VkCommandBuffer CommandRecorder::nextCommandBuffer(ThreadCommandPool& pool)
+{
+    if (pool.usedCount == pool.commandBuffers.size())
+    {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(m_device->getVkDevice(), &allocInfo, &commandBuffer));
+        pool.commandBuffers.push_back(commandBuffer);
+    }
+
+    VkCommandBuffer commandBuffer = pool.commandBuffers[pool.usedCount++];
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &m_inheritanceInfo;
+
+    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+    return commandBuffer;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Device;
+
+// Records the commands of a subpass on several threads. Every thread has its own command pool per frame in flight,
+// so recording needs no locking, and records a contiguous range of the tasks into a secondary command buffer.
+// The calling thread records the first range, the others are recorded by worker threads.
+class CommandRecorder
+{
+public:
+    // Records the tasks [begin, end) into commandBuffer. It is called on several threads at once.
+    // Dynamic state isn't inherited by secondary command buffers, viewport and scissor have to be set again.
+    using RecordFunc = std::function<void(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end)>;
+
+    // A threadCount of 0 uses one thread per core
+    void init(Device* device, uint32_t framesInFlight, uint32_t threadCount = 0);
+    void destroy();
+
+    // Resets the command pools of frame, the GPU has to be done with the commands last recorded for it
+    void beginFrame(uint32_t frame);
+
+    // Records taskCount tasks split over all threads and executes the secondary command buffers in order.
+    // primaryCommandBuffer has to be inside subpass of renderPass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+    void record(VkCommandBuffer primaryCommandBuffer, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer,
+        uint32_t taskCount, const RecordFunc& recordFunc);
+
+    uint32_t getThreadCount() const { return m_threadCount; }
+
+private:
+    struct ThreadCommandPool
+    {
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        // secondary command buffers are kept across pool resets and reused in allocation order
+        std::vector<VkCommandBuffer> commandBuffers;
+        uint32_t usedCount = 0;
+    };
+
+    void workerLoop(uint32_t threadIndex);
+    void recordRange(uint32_t threadIndex);
+    VkCommandBuffer nextCommandBuffer(ThreadCommandPool& pool);
+
+    Device* m_device = nullptr;
+    uint32_t m_threadCount = 0;
+    uint32_t m_currentFrame = 0;
+    // indexed by frame * thread count + thread
+    std::vector<ThreadCommandPool> m_pools;
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_workDone;
+    uint64_t m_generation = 0;
+    uint32_t m_busyWorkers = 0;
+    bool m_quit = false;
+
+    // the job that is currently recorded, written before the workers are woken up
+    const RecordFunc* m_recordFunc = nullptr;
+    VkCommandBufferInheritanceInfo m_inheritanceInfo = {};
+    uint32_t m_taskCount = 0;
+    std::vector<VkCommandBuffer> m_recordedCommandBuffers;
+};
@@ -0,0 +1,97 @@
+#include "deletionqueue.h"
+#include "vulkanhelper.h"
+#include "device.h"
+
+void DeletionQueue::init(Device* device)
+{
+    m_device = device;
+    m_frame = 1;
+}
+
+void DeletionQueue::destroy()
+{
+    flush();
+    m_device = nullptr;
+}
+
+void DeletionQueue::destroyBuffer(VkBuffer buffer, const MemoryAllocation& memory)
+{
+    push([this, buffer, allocation = memory]() mutable { m_device->destroyBuffer(buffer, allocation); });
+}
+
+void DeletionQueue::destroyImage(VkImage image, const MemoryAllocation& memory)
+{
+    push([this, image, allocation = memory]() mutable { m_device->destroyImage(image, allocation); });
+}
+
+void DeletionQueue::destroyImageView(VkImageView imageView)
+{
+    push([this, imageView]() { vkDestroyImageView(m_device->getVkDevice(), imageView, nullptr); });
+}
+
+void DeletionQueue::freeMemory(const MemoryAllocation& memory)
+{
+    push([this, allocation = memory]() mutable { m_device->freeMemory(allocation); });
+}
+
+void DeletionQueue::destroyPipeline(VkPipeline pipeline)
+{
+    push([this, pipeline]() { vkDestroyPipeline(m_device->getVkDevice(), pipeline, nullptr); });
+}
+
+void DeletionQueue::destroyDescriptorPool(VkDescriptorPool descriptorPool)
+{
+    push([this, descriptorPool]() { vkDestroyDescriptorPool(m_device->getVkDevice(), descriptorPool, nullptr); });
+}
+
+void DeletionQueue::destroyDescriptorSetLayout(VkDescriptorSetLayout descriptorSetLayout)
+{
+    push([this, descriptorSetLayout]() { vkDestroyDescriptorSetLayout(m_device->getVkDevice(), descriptorSetLayout, nullptr); });
+}
+
+void DeletionQueue::destroyFramebuffer(VkFramebuffer framebuffer)
+{
+    push([this, framebuffer]() { vkDestroyFramebuffer(m_device->getVkDevice(), framebuffer, nullptr); });
+}
+
+void DeletionQueue::destroySwapChain(VkSwapchainKHR swapChain)
+{
+    push([this, swapChain]() { vkDestroySwapchainKHR(m_device->getVkDevice(), swapChain, nullptr); });
+}
+
+void DeletionQueue::destroyQueryPool(VkQueryPool queryPool)
+{
+    push([this, queryPool]() { vkDestroyQueryPool(m_device->getVkDevice(), queryPool, nullptr); });
+}
+
+void DeletionQueue::freeCommandBuffers(VkCommandPool commandPool, const std::vector<VkCommandBuffer>& commandBuffers)
+{
+    if (commandBuffers.empty())
+        return;
+
+    push([this, commandPool, commandBuffers]()
+    {
+        vkFreeCommandBuffers(m_device->getVkDevice(), commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    });
+}
+
+void DeletionQueue::push(std::function<void()> destroy)
+{
+    assert(m_device);
+    m_entries.push_back({ m_frame, std::move(destroy) });
+}
+
+void DeletionQueue::collect(uint64_t completedFrame)
+{
+    // entries are pushed with increasing frame numbers
+    while (!m_entries.empty() && m_entries.front().frame <= completedFrame)
+    {
+        m_entries.front().destroy();
+        m_entries.pop_front();
+    }
+}
+
+void DeletionQueue::flush()
+{
+    collect(UINT64_MAX);
+}
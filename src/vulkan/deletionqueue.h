@@ -0,0 +1,58 @@
+#pragma once
+
+#include "memoryallocator.h"
+
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+class Device;
+
+// Destroys resources once every frame that may still use them finished on the GPU, so they can be
+// released while frames are in flight without idling the device.
+// Frames are numbered by the renderer through nextFrame and collect, without one everything is kept until flush.
+class DeletionQueue
+{
+public:
+    void init(Device* device);
+    // Destroys everything that is left, the device has to be idle
+    void destroy();
+
+    void destroyBuffer(VkBuffer buffer, const MemoryAllocation& memory);
+    void destroyImage(VkImage image, const MemoryAllocation& memory);
+    void destroyImageView(VkImageView imageView);
+    void freeMemory(const MemoryAllocation& memory);
+    void destroyPipeline(VkPipeline pipeline);
+    void destroyDescriptorPool(VkDescriptorPool descriptorPool);
+    void destroyDescriptorSetLayout(VkDescriptorSetLayout descriptorSetLayout);
+    void destroyFramebuffer(VkFramebuffer framebuffer);
+    void destroySwapChain(VkSwapchainKHR swapChain);
+    void destroyQueryPool(VkQueryPool queryPool);
+    void freeCommandBuffers(VkCommandPool commandPool, const std::vector<VkCommandBuffer>& commandBuffers);
+
+    // Number of the frame that is recorded next, resources destroyed now wait for it to finish
+    uint64_t getFrame() const { return m_frame; }
+    // Called after the frame returned by getFrame was submitted
+    void nextFrame() { m_frame++; }
+    // Destroys the resources of all frames up to and including completedFrame
+    void collect(uint64_t completedFrame);
+    // Destroys all resources, the device has to be idle
+    void flush();
+
+    size_t getPendingCount() const { return m_entries.size(); }
+
+private:
+    struct Entry
+    {
+        uint64_t frame;
+        std::function<void()> destroy;
+    };
+
+    void push(std::function<void()> destroy);
+
+    Device* m_device = nullptr;
+    // frame numbers start at 1 so 0 means nothing has completed yet
+    uint64_t m_frame = 1;
+    std::deque<Entry> m_entries;
+};
@@ -1,5 +1,6 @@
 #include "descriptorset.h"
 #include "vulkanhelper.h"
+#include "device.h"
 
 void DescriptorSet::addSampler(VkImageView textureImageView, VkSampler sampler)
 {
@@ -68,11 +69,14 @@ void DescriptorSet::bind(VkCommandBuffer commandBuffer, VkPipelineLayout pipelin
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &m_descriptorSet, 0, nullptr);
 }
 
-void DescriptorSet::destroy(VkDevice device)
+void DescriptorSet::destroy(Device* device)
 {
-    vkDestroyDescriptorSetLayout(device, m_layout, nullptr);
+    // frames in flight may still have the set bound
+    DeletionQueue& deletionQueue = device->getDeletionQueue();
+    deletionQueue.destroyDescriptorSetLayout(m_layout);
     m_layout = VK_NULL_HANDLE;
 
-    vkDestroyDescriptorPool(device, m_descriptorPool, nullptr);
+    deletionQueue.destroyDescriptorPool(m_descriptorPool);
     m_descriptorPool = VK_NULL_HANDLE;
+    m_descriptorSet = VK_NULL_HANDLE;
 }
@@ -3,6 +3,8 @@
 #include <vulkan/vulkan.h>
 #include <vector>
 
+class Device;
+
 class DescriptorSet
 {
 public:
@@ -14,7 +16,7 @@ public:
 
     VkDescriptorSetLayout getLayout() const { return m_layout; }
 
-    void destroy(VkDevice device);
+    void destroy(Device* device);
 
 private:
     VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
@@ -1,11 +1,31 @@
 #include "device.h"
 #include "vulkanhelper.h"
 #include "debug.h"
+#include "trace.h"
 
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 
-bool Device::init(VkInstance instance, VkSurfaceKHR surface, bool enableValidationLayers)
+const char* const Device::DefaultPipelineCacheFile = "pipelinecache.bin";
+
+const char* toString(UploadPath path)
 {
+    switch (path)
+    {
+    case UploadPath::Staged: return "staged";
+    case UploadPath::Direct: return "direct";
+    }
+    return "unknown";
+}
+
+bool Device::init(VkInstance instance, VkSurfaceKHR surface, bool enableValidationLayers, const std::string& pipelineCacheFile)
+{
+    m_pipelineCacheFile = pipelineCacheFile;
+
     uint32_t numDevices = 0;
     VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &numDevices, nullptr));
     if (numDevices == 0)
@@ -32,32 +52,56 @@ bool Device::init(VkInstance instance, VkSurfaceKHR surface, bool enableValidati
         return false;
     }
 
+    m_transferQueueFamilyIndex = findTransferQueueFamily(m_physicalDevice);
+
     auto queuePriority = 1.0f;
 
-    VkDeviceQueueCreateInfo queueCreateInfo = {
-        VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,     // VkStructureType              sType
-        nullptr,                                        // const void                  *pNext
-        0,                                              // VkDeviceQueueCreateFlags     flags
-        m_graphicsQueueFamilyIndex,                     // uint32_t                     queueFamilyIndex
-        1,                                              // uint32_t                     queueCount
-        &queuePriority                                  // const float                 *pQueuePriorities
-    };
+    // One queue of every distinct family that is used
+    std::vector<uint32_t> queueFamilies = { m_graphicsQueueFamilyIndex };
+    if (m_presentQueueFamilyIndex != m_graphicsQueueFamilyIndex)
+        queueFamilies.push_back(m_presentQueueFamilyIndex);
+    if (std::find(queueFamilies.begin(), queueFamilies.end(), m_transferQueueFamilyIndex) == queueFamilies.end())
+        queueFamilies.push_back(m_transferQueueFamilyIndex);
 
-    std::vector<const char*> extensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME
-    };
+    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+    for (auto queueFamily : queueFamilies)
+    {
+        VkDeviceQueueCreateInfo queueCreateInfo = {
+            VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,     // VkStructureType              sType
+            nullptr,                                        // const void                  *pNext
+            0,                                              // VkDeviceQueueCreateFlags     flags
+            queueFamily,                                    // uint32_t                     queueFamilyIndex
+            1,                                              // uint32_t                     queueCount
+            &queuePriority                                  // const float                 *pQueuePriorities
+        };
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
+
+    // Without a surface there is nothing to present to, so the swap chain extension isn't needed
+    std::vector<const char*> extensions;
+    if (surface != VK_NULL_HANDLE)
+    {
+        extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+
+    // optional features, the renderer has a fallback for each of them
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+    m_enabledFeatures = {};
+    m_enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    m_enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
 
     VkDeviceCreateInfo deviceCreateInfo = {
         VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,           // VkStructureType                    sType
         nullptr,                                        // const void                        *pNext
         0,                                              // VkDeviceCreateFlags                flags
-        1,                                              // uint32_t                           queueCreateInfoCount
-        &queueCreateInfo,                               // const VkDeviceQueueCreateInfo     *pQueueCreateInfos
+        static_cast<uint32_t>(queueCreateInfos.size()), // uint32_t                           queueCreateInfoCount
+        queueCreateInfos.data(),                        // const VkDeviceQueueCreateInfo     *pQueueCreateInfos
         0,                                              // uint32_t                           enabledLayerCount
         nullptr,                                        // const char * const                *ppEnabledLayerNames
         static_cast<uint32_t>(extensions.size()),       // uint32_t                           enabledExtensionCount
-        &extensions[0],                                 // const char * const                *ppEnabledExtensionNames
-        nullptr                                         // const VkPhysicalDeviceFeatures    *pEnabledFeatures
+        extensions.data(),                              // const char * const                *ppEnabledExtensionNames
+        &m_enabledFeatures                              // const VkPhysicalDeviceFeatures    *pEnabledFeatures
     };
 
     if (enableValidationLayers)
@@ -70,8 +114,15 @@ bool Device::init(VkInstance instance, VkSurfaceKHR surface, bool enableValidati
 
     vkGetDeviceQueue(m_device, m_presentQueueFamilyIndex, 0, &m_presentQueue);
     vkGetDeviceQueue(m_device, m_graphicsQueueFamilyIndex, 0, &m_graphicsQueue);
+    vkGetDeviceQueue(m_device, m_transferQueueFamilyIndex, 0, &m_transferQueue);
+
+    createCommandPools();
+    createPipelineCache();
 
-    createCommandPool();
+    m_memoryTypes.init(m_physicalDevice);
+    m_allocator.init(m_device, m_physicalDevice, m_memoryTypes);
+    m_stagingBuffer.init(this);
+    m_deletionQueue.init(this);
 
     return true;
 }
@@ -112,7 +163,11 @@ bool Device::checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, VkSu
 
     for (uint32_t i = 0; i < queueCount; ++i)
     {
-        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &supportsPresent[i]);
+        // Headless rendering doesn't present, so every queue family is as good as a presenting one
+        if (surface != VK_NULL_HANDLE)
+            vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &supportsPresent[i]);
+        else
+            supportsPresent[i] = VK_TRUE;
 
         if ((queueProps[i].queueCount > 0) &&
             (queueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
@@ -145,7 +200,7 @@ bool Device::checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, VkSu
 
     // If this device doesn't support queues with graphics and present capabilities don't use it
     if ((m_graphicsQueueFamilyIndex == UINT32_MAX) ||
-        (m_graphicsQueueFamilyIndex == UINT32_MAX))
+        (m_presentQueueFamilyIndex == UINT32_MAX))
     {
         std::cout << "Could not find queue family with required properties on physical device " << physicalDevice << "!" << std::endl;
         return false;
@@ -154,28 +209,140 @@ bool Device::checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, VkSu
     return true;
 }
 
-void Device::createCommandPool()
+uint32_t Device::findTransferQueueFamily(VkPhysicalDevice physicalDevice) const
+{
+    uint32_t queueCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueProps(queueCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, queueProps.data());
+
+    // A family with transfer but without graphics or compute is usually backed by the DMA engines
+    // and runs copies concurrently with rendering. Images of any size have to be copyable, which
+    // requires a transfer granularity of a single texel.
+    for (uint32_t i = 0; i < queueCount; ++i)
+    {
+        const VkQueueFamilyProperties& props = queueProps[i];
+        const VkExtent3D& granularity = props.minImageTransferGranularity;
+
+        if ((props.queueCount > 0) &&
+            (props.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(props.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+        {
+            return i;
+        }
+    }
+
+    // Graphics queues always support transfers
+    return m_graphicsQueueFamilyIndex;
+}
+
+void Device::createPipelineCache()
+{
+    std::vector<char> data;
+    if (!m_pipelineCacheFile.empty())
+    {
+        std::ifstream file(m_pipelineCacheFile, std::ios::binary);
+        if (file)
+        {
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+    }
+
+    // The driver is supposed to ignore incompatible data, but not all of them check it.
+    // A cache written by another device or driver version is discarded here.
+    struct Header
+    {
+        uint32_t headerSize;
+        uint32_t headerVersion;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    };
+
+    if (!data.empty())
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+        Header header = {};
+        if (data.size() >= sizeof(Header))
+        {
+            memcpy(&header, data.data(), sizeof(Header));
+        }
+
+        if (data.size() < sizeof(Header) ||
+            header.headerSize < sizeof(Header) ||
+            header.headerSize > data.size() ||
+            header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            header.vendorID != properties.vendorID ||
+            header.deviceID != properties.deviceID ||
+            memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            std::cout << "Discarding stale pipeline cache " << m_pipelineCacheFile << std::endl;
+            data.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    VK_CHECK_RESULT(vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &m_pipelineCache));
+}
+
+void Device::savePipelineCache()
+{
+    if (m_pipelineCacheFile.empty())
+        return;
+
+    size_t size = 0;
+    VK_CHECK_RESULT(vkGetPipelineCacheData(m_device, m_pipelineCache, &size, nullptr));
+    std::vector<char> data(size);
+    VK_CHECK_RESULT(vkGetPipelineCacheData(m_device, m_pipelineCache, &size, data.data()));
+
+    // write to a temporary file first so a process killed while writing doesn't leave a truncated cache behind
+    const std::string tempFile = m_pipelineCacheFile + ".tmp";
+    {
+        std::ofstream file(tempFile, std::ios::binary | std::ios::trunc);
+        if (!file.write(data.data(), size))
+        {
+            std::cout << "Could not write pipeline cache " << tempFile << std::endl;
+            return;
+        }
+    }
+
+    std::remove(m_pipelineCacheFile.c_str());
+    if (std::rename(tempFile.c_str(), m_pipelineCacheFile.c_str()) != 0)
+    {
+        std::cout << "Could not write pipeline cache " << m_pipelineCacheFile << std::endl;
+    }
+}
+
+void Device::createCommandPools()
 {
     VkCommandPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.queueFamilyIndex = m_graphicsQueueFamilyIndex;
 
     VK_CHECK_RESULT(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool));
+
+    if (hasDedicatedTransferQueue())
+    {
+        poolInfo.queueFamilyIndex = m_transferQueueFamilyIndex;
+        VK_CHECK_RESULT(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_transferCommandPool));
+    }
+    else
+    {
+        m_transferCommandPool = m_commandPool;
+    }
 }
 
-void Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+void Device::createBuffer(uint32_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory, VkMemoryPropertyFlags preferredProperties)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferCopy copyRegion = {};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    endSingleTimeCommands(commandBuffer);
-}
+    TRACE_ZONE("Device::createBuffer");
 
-void Device::createBuffer(uint32_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
-{
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
@@ -187,24 +354,26 @@ void Device::createBuffer(uint32_t size, VkBufferUsageFlags usage, VkMemoryPrope
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(m_physicalDevice, memRequirements.memoryTypeBits, properties);
+    const uint32_t memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties, preferredProperties, memRequirements.size);
+    if (!m_allocator.allocate(memRequirements, memoryTypeIndex, true, bufferMemory))
+    {
+        VK_CHECK_RESULT(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    }
 
-    VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocInfo, nullptr, &bufferMemory));
-    VK_CHECK_RESULT(vkBindBufferMemory(m_device, buffer, bufferMemory, 0));
+    VK_CHECK_RESULT(vkBindBufferMemory(m_device, buffer, bufferMemory.memory, bufferMemory.offset));
 }
 
-void Device::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+void Device::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, uint32_t mipLevels)
 {
+    TRACE_ZONE("Device::createImage");
+
     VkImageCreateInfo imageInfo = {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
     imageInfo.tiling = tiling;
@@ -218,13 +387,59 @@ void Device::createImage(uint32_t width, uint32_t height, VkFormat format, VkIma
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(m_device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(m_physicalDevice, memRequirements.memoryTypeBits, properties);
+    // linear tiled images may share pages with buffers, optimal tiled ones may not
+    const uint32_t memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties, 0, memRequirements.size);
+    if (!m_allocator.allocate(memRequirements, memoryTypeIndex, tiling == VK_IMAGE_TILING_LINEAR, imageMemory))
+    {
+        VK_CHECK_RESULT(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    }
+
+    VK_CHECK_RESULT(vkBindImageMemory(m_device, image, imageMemory.memory, imageMemory.offset));
+}
+
+void Device::recordUpload(const char* resource, UploadPath path, VkDeviceSize size)
+{
+    m_uploadRecords.push_back({ resource, path, size });
+}
+
+VkDeviceSize Device::getUploadedBytes(UploadPath path) const
+{
+    VkDeviceSize bytes = 0;
+    for (const auto& record : m_uploadRecords)
+    {
+        if (record.path == path)
+            bytes += record.size;
+    }
+    return bytes;
+}
 
-    VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocInfo, nullptr, &imageMemory));
-    VK_CHECK_RESULT(vkBindImageMemory(m_device, image, imageMemory, 0));
+void Device::flushMemory(const MemoryAllocation& memory, VkDeviceSize offset, VkDeviceSize size)
+{
+    m_allocator.flush(memory, offset, size);
+}
+
+void Device::invalidateMemory(const MemoryAllocation& memory, VkDeviceSize offset, VkDeviceSize size)
+{
+    m_allocator.invalidate(memory, offset, size);
+}
+
+void Device::destroyBuffer(VkBuffer& buffer, MemoryAllocation& bufferMemory)
+{
+    vkDestroyBuffer(m_device, buffer, nullptr);
+    buffer = VK_NULL_HANDLE;
+    m_allocator.free(bufferMemory);
+}
+
+void Device::destroyImage(VkImage& image, MemoryAllocation& imageMemory)
+{
+    vkDestroyImage(m_device, image, nullptr);
+    image = VK_NULL_HANDLE;
+    m_allocator.free(imageMemory);
+}
+
+void Device::freeMemory(MemoryAllocation& memory)
+{
+    m_allocator.free(memory);
 }
 
 void Device::createSampler(VkSampler& sampler)
@@ -245,136 +460,80 @@ void Device::createSampler(VkSampler& sampler)
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    // sample from every level the image view exposes
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
     VK_CHECK_RESULT(vkCreateSampler(m_device, &samplerInfo, nullptr, &sampler));
 }
 
-uint32_t Device::findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties)
+uint32_t Device::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, VkMemoryPropertyFlags preferredProperties, VkDeviceSize size) const
 {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (auto i = 0u; i < memProperties.memoryTypeCount; i++)
-    {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-        {
-            return i;
-        }
-    }
-
-    return ~0u;
+    return m_memoryTypes.find(typeBits, properties, preferredProperties, size, &m_allocator.getHeapUsage());
 }
 
-void Device::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+uint64_t Device::submit(VkQueue queue, const VkSubmitInfo& submitInfo)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier = {};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-
-    VkPipelineStageFlags sourceStage;
-    VkPipelineStageFlags destinationStage;
-
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    VkFence fence = VK_NULL_HANDLE;
+    if (m_freeFences.empty())
     {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-    {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VK_CHECK_RESULT(vkCreateFence(m_device, &fenceInfo, nullptr, &fence));
     }
     else
     {
-        throw std::invalid_argument("unsupported layout transition!");
+        fence = m_freeFences.back();
+        m_freeFences.pop_back();
     }
 
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        sourceStage, destinationStage,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier
-    );
+    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
 
-    endSingleTimeCommands(commandBuffer);
+    const uint64_t submission = m_nextSubmission++;
+    m_pendingSubmissions.push_back({ submission, fence });
+    return submission;
 }
 
-void Device::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+bool Device::isSubmissionComplete(uint64_t submission)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = { 0, 0, 0 };
-    region.imageExtent = { width, height, 1 };
-
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    endSingleTimeCommands(commandBuffer);
+    bool complete = submission < m_nextSubmission;
+    for (auto it = m_pendingSubmissions.begin(); it != m_pendingSubmissions.end();)
+    {
+        if (vkGetFenceStatus(m_device, it->fence) == VK_SUCCESS)
+        {
+            retireSubmission(it);
+            it = m_pendingSubmissions.erase(it);
+        }
+        else
+        {
+            if (it->id == submission)
+                complete = false;
+            ++it;
+        }
+    }
+    return complete;
 }
 
-VkCommandBuffer Device::beginSingleTimeCommands()
+void Device::waitForSubmission(uint64_t submission)
 {
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_commandPool;
-    allocInfo.commandBufferCount = 1;
+    TRACE_ZONE("Device::waitForSubmission");
 
-    VkCommandBuffer commandBuffer;
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer));
+    auto it = std::find_if(m_pendingSubmissions.begin(), m_pendingSubmissions.end(),
+        [submission](const Submission& pending) { return pending.id == submission; });
+    if (it == m_pendingSubmissions.end())
+        return;
 
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
-
-    return commandBuffer;
+    VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &it->fence, VK_TRUE, UINT64_MAX));
+    retireSubmission(it);
+    m_pendingSubmissions.erase(it);
 }
 
-void Device::endSingleTimeCommands(VkCommandBuffer commandBuffer)
+void Device::retireSubmission(std::deque<Submission>::iterator submission)
 {
-    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    VK_CHECK_RESULT(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
-    VK_CHECK_RESULT(vkQueueWaitIdle(m_graphicsQueue));
-
-    vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+    VK_CHECK_RESULT(vkResetFences(m_device, 1, &submission->fence));
+    m_freeFences.push_back(submission->fence);
 }
 
-void Device::createImageView(VkImage image, VkFormat format, VkImageView& imageView)
+void Device::createImageView(VkImage image, VkFormat format, VkImageView& imageView, uint32_t mipLevels)
 {
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -388,7 +547,7 @@ void Device::createImageView(VkImage image, VkFormat format, VkImageView& imageV
     };
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -400,6 +559,31 @@ void Device::createImageView(VkImage image, VkFormat format, VkImageView& imageV
 
 void Device::destroy()
 {
+    m_deletionQueue.destroy();
+    m_stagingBuffer.destroy();
+
+    while (!m_pendingSubmissions.empty())
+    {
+        waitForSubmission(m_pendingSubmissions.front().id);
+    }
+    for (auto fence : m_freeFences)
+    {
+        vkDestroyFence(m_device, fence, nullptr);
+    }
+    m_freeFences.clear();
+
+    m_allocator.destroy();
+
+    savePipelineCache();
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
+    m_pipelineCache = VK_NULL_HANDLE;
+
+    if (m_transferCommandPool != m_commandPool)
+    {
+        vkDestroyCommandPool(m_device, m_transferCommandPool, nullptr);
+    }
+    m_transferCommandPool = VK_NULL_HANDLE;
+
     vkDestroyCommandPool(m_device, m_commandPool, nullptr);
     m_commandPool = VK_NULL_HANDLE;
 
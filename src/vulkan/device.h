@@ -1,43 +1,134 @@
 #pragma once
 
+#include "memoryallocator.h"
+#include "memorytypes.h"
+#include "stagingbuffer.h"
+#include "deletionqueue.h"
+
 #include <vulkan/vulkan.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+enum class UploadPath
+{
+    // written to staging memory and copied on the GPU
+    Staged,
+    // written by the CPU straight into host visible device local memory
+    Direct
+};
+
+const char* toString(UploadPath path);
 
 class Device
 {
 public:
-    bool init(VkInstance instance, VkSurfaceKHR surface, bool enableValidationLayers);
+    static const char* const DefaultPipelineCacheFile;
+
+    struct UploadRecord
+    {
+        const char* resource;
+        UploadPath path;
+        VkDeviceSize size;
+    };
+
+    // Pass VK_NULL_HANDLE as surface for headless rendering without presentation support.
+    // The pipeline cache is loaded from pipelineCacheFile and written back to it on destroy,
+    // an empty filename disables persisting it.
+    bool init(VkInstance instance, VkSurfaceKHR surface, bool enableValidationLayers, const std::string& pipelineCacheFile = DefaultPipelineCacheFile);
     void destroy();
 
     void createSampler(VkSampler& sampler);
-    void createBuffer(uint32_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
-    void createImageView(VkImage image, VkFormat format, VkImageView& imageView);
+    // Memory gets all of properties and as many of preferredProperties as a type with room in its heap has
+    void createBuffer(uint32_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory, VkMemoryPropertyFlags preferredProperties = 0);
+    void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, uint32_t mipLevels = 1);
+    void createImageView(VkImage image, VkFormat format, VkImageView& imageView, uint32_t mipLevels = 1);
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    // Destroy immediately, resources that may still be used by frames in flight go through getDeletionQueue instead
+    void destroyBuffer(VkBuffer& buffer, MemoryAllocation& bufferMemory);
+    void destroyImage(VkImage& image, MemoryAllocation& imageMemory);
+    void freeMemory(MemoryAllocation& memory);
 
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
+    // Only needed for memory without HOST_COHERENT, the range is relative to the allocation
+    void flushMemory(const MemoryAllocation& memory, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    void invalidateMemory(const MemoryAllocation& memory, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
 
     VkDevice getVkDevice() const { return m_device; };
     VkPhysicalDevice getVkPysicalDevice() const { return m_physicalDevice; };
     VkQueue getPresentationQueue() const { return m_presentQueue; };
     VkQueue getGraphicsQueue() const { return m_graphicsQueue; };
     VkCommandPool getCommandPool() const { return m_commandPool; };
+    uint32_t getGraphicsQueueFamilyIndex() const { return m_graphicsQueueFamilyIndex; }
+
+    // Without a transfer only queue family these are the graphics queue and command pool
+    VkQueue getTransferQueue() const { return m_transferQueue; }
+    VkCommandPool getTransferCommandPool() const { return m_transferCommandPool; }
+    uint32_t getTransferQueueFamilyIndex() const { return m_transferQueueFamilyIndex; }
+    bool hasDedicatedTransferQueue() const { return m_transferQueueFamilyIndex != m_graphicsQueueFamilyIndex; }
+
+    VkPipelineCache getPipelineCache() const { return m_pipelineCache; }
+    MemoryAllocator::Statistics getMemoryStatistics() const { return m_allocator.getStatistics(); }
+    const MemoryTypeTable& getMemoryTypes() const { return m_memoryTypes; }
+    // Optional features that are enabled because the physical device supports them
+    const VkPhysicalDeviceFeatures& getEnabledFeatures() const { return m_enabledFeatures; }
+    const std::vector<VkDeviceSize>& getHeapUsage() const { return m_allocator.getHeapUsage(); }
+    // Best memory type for a resource given its memory type bits and size, UINT32_MAX if there is none
+    uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, VkMemoryPropertyFlags preferredProperties = 0, VkDeviceSize size = 0) const;
+    VkMemoryPropertyFlags getMemoryFlags(const MemoryAllocation& memory) const { return m_memoryTypes.getTypeFlags(memory.memoryTypeIndex); }
+    StagingBuffer& getStagingBuffer() { return m_stagingBuffer; }
+
+    // Lets uploads write buffers directly when they end up in host visible memory, on by default
+    void setDirectUploads(bool enabled) { m_directUploads = enabled; }
+    bool getDirectUploads() const { return m_directUploads; }
+    // Every upload reports the path it took, the log is kept until clearUploadRecords
+    void recordUpload(const char* resource, UploadPath path, VkDeviceSize size);
+    const std::vector<UploadRecord>& getUploadRecords() const { return m_uploadRecords; }
+    VkDeviceSize getUploadedBytes(UploadPath path) const;
+    void clearUploadRecords() { m_uploadRecords.clear(); }
+    DeletionQueue& getDeletionQueue() { return m_deletionQueue; }
+
+    // Submits with a fence and returns an id to query the completion of the submission with
+    uint64_t submit(VkQueue queue, const VkSubmitInfo& submitInfo);
+    bool isSubmissionComplete(uint64_t submission);
+    void waitForSubmission(uint64_t submission);
 
 private:
-    bool checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
-    void createCommandPool();
+    struct Submission
+    {
+        uint64_t id;
+        VkFence fence;
+    };
 
-    VkCommandBuffer beginSingleTimeCommands();
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+    bool checkPhysicalDeviceProperties(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
+    uint32_t findTransferQueueFamily(VkPhysicalDevice physicalDevice) const;
+    void createCommandPools();
+    void createPipelineCache();
+    void savePipelineCache();
 
-    static uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    void retireSubmission(std::deque<Submission>::iterator submission);
 
     VkDevice m_device = VK_NULL_HANDLE;
     VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
     uint32_t m_presentQueueFamilyIndex = UINT32_MAX;
     uint32_t m_graphicsQueueFamilyIndex = UINT32_MAX;
+    uint32_t m_transferQueueFamilyIndex = UINT32_MAX;
     VkQueue m_presentQueue = VK_NULL_HANDLE;
     VkQueue m_graphicsQueue = VK_NULL_HANDLE;
+    VkQueue m_transferQueue = VK_NULL_HANDLE;
     VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    VkCommandPool m_transferCommandPool = VK_NULL_HANDLE;
+    VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+    std::string m_pipelineCacheFile;
+    VkPhysicalDeviceFeatures m_enabledFeatures = {};
+    MemoryTypeTable m_memoryTypes;
+    MemoryAllocator m_allocator;
+    StagingBuffer m_stagingBuffer;
+    DeletionQueue m_deletionQueue;
+
+    bool m_directUploads = true;
+    std::vector<UploadRecord> m_uploadRecords;
+
+    uint64_t m_nextSubmission = 1;
+    std::deque<Submission> m_pendingSubmissions;
+    std::vector<VkFence> m_freeFences;
 };
\ No newline at end of file
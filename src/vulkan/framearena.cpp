@@ -0,0 +1,63 @@
+#include "framearena.h"
+#include "vulkanhelper.h"
+#include "device.h"
+
+#include <algorithm>
+
+void FrameArena::init(Device* device, uint32_t framesInFlight, VkDeviceSize frameSize)
+{
+    m_device = device;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_device->getVkPysicalDevice(), &properties);
+    m_uniformAlignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 4);
+
+    // regions start on a non coherent atom so flushing one frame never touches the next
+    const VkDeviceSize regionAlignment = std::max(m_uniformAlignment, properties.limits.nonCoherentAtomSize);
+    m_frameSize = (frameSize + regionAlignment - 1) / regionAlignment * regionAlignment;
+
+    // read straight from device local memory where the CPU can write it, system memory otherwise
+    m_device->createBuffer(static_cast<uint32_t>(m_frameSize * framesInFlight),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        m_buffer, m_memory,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    m_data = static_cast<uint8_t*>(m_memory.mappedData);
+    beginFrame(0);
+}
+
+void FrameArena::destroy()
+{
+    if (m_buffer != VK_NULL_HANDLE)
+    {
+        m_device->destroyBuffer(m_buffer, m_memory);
+        m_data = nullptr;
+    }
+}
+
+void FrameArena::beginFrame(uint32_t frame)
+{
+    m_frameBegin = frame * m_frameSize;
+    m_frameEnd = m_frameBegin + m_frameSize;
+    m_head = m_frameBegin;
+}
+
+void FrameArena::endFrame()
+{
+    m_device->flushMemory(m_memory, m_frameBegin, m_head - m_frameBegin);
+}
+
+bool FrameArena::allocate(VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation)
+{
+    const VkDeviceSize offset = (m_head + alignment - 1) / alignment * alignment;
+    if (offset + size > m_frameEnd)
+        return false;
+
+    m_head = offset + size;
+
+    allocation.buffer = m_buffer;
+    allocation.offset = offset;
+    allocation.data = m_data + offset;
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "memoryallocator.h"
+
+#include <vulkan/vulkan.h>
+
+class Device;
+
+// Linear allocator for data the CPU writes every frame: dynamic vertices, indices and uniforms.
+// One persistently mapped buffer is split into a region per frame in flight, an allocation only bumps
+// the offset of the current region. A region is reset when its frame begins again, after the renderer
+// waited for the fence of the frame that used it before.
+// Not thread safe, allocate on the thread that records the frame and hand the allocations to workers.
+class FrameArena
+{
+public:
+    static const VkDeviceSize DefaultFrameSize = 4 * 1024 * 1024;
+
+    struct Allocation
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        void* data = nullptr;
+    };
+
+    void init(Device* device, uint32_t framesInFlight, VkDeviceSize frameSize = DefaultFrameSize);
+    // The device has to be idle
+    void destroy();
+
+    // The fence of the frame that last used this region has to be signaled
+    void beginFrame(uint32_t frame);
+    // Flushes the bytes written this frame, before the command buffer reading them is submitted
+    void endFrame();
+
+    // Returns false if the region of the frame has no room left
+    bool allocate(VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation);
+    bool allocateVertices(VkDeviceSize size, Allocation& allocation) { return allocate(size, 4, allocation); }
+    bool allocateIndices(VkDeviceSize size, Allocation& allocation) { return allocate(size, 4, allocation); }
+    bool allocateUniforms(VkDeviceSize size, Allocation& allocation) { return allocate(size, m_uniformAlignment, allocation); }
+
+    VkBuffer getBuffer() const { return m_buffer; }
+    VkDeviceSize getFrameSize() const { return m_frameSize; }
+    // Bytes allocated in the current frame including alignment padding
+    VkDeviceSize getUsedBytes() const { return m_head - m_frameBegin; }
+
+private:
+    Device* m_device = nullptr;
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_memory;
+    uint8_t* m_data = nullptr;
+    VkDeviceSize m_frameSize = 0;
+    VkDeviceSize m_uniformAlignment = 1;
+
+    VkDeviceSize m_frameBegin = 0;
+    VkDeviceSize m_frameEnd = 0;
+    VkDeviceSize m_head = 0;
+};
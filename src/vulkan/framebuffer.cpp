@@ -1,8 +1,9 @@
 #include "framebuffer.h"
 #include "vulkanhelper.h"
+#include "device.h"
 
 
-bool Framebuffer::init(VkDevice device, VkRenderPass renderPass, VkImageView attachment, VkExtent2D extent)
+bool Framebuffer::init(Device* device, VkRenderPass renderPass, VkImageView attachment, VkExtent2D extent)
 {
     m_device = device;
 
@@ -15,13 +16,16 @@ bool Framebuffer::init(VkDevice device, VkRenderPass renderPass, VkImageView att
     framebufferInfo.height = extent.height;
     framebufferInfo.layers = 1;
 
-    VK_CHECK_RESULT(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &m_framebuffer));
+    VK_CHECK_RESULT(vkCreateFramebuffer(m_device->getVkDevice(), &framebufferInfo, nullptr, &m_framebuffer));
 
     return true;
 }
 
 void Framebuffer::destroy()
-{ 
-    vkDestroyFramebuffer(m_device, m_framebuffer, nullptr);
+{
+    if (m_framebuffer == VK_NULL_HANDLE)
+        return;
+
+    m_device->getDeletionQueue().destroyFramebuffer(m_framebuffer);
     m_framebuffer = VK_NULL_HANDLE;
 }
@@ -2,15 +2,18 @@
 
 #include <vulkan/vulkan.h>
 
+class Device;
+
 class Framebuffer
 {
 public:
-    bool init(VkDevice device, VkRenderPass renderPass, VkImageView attachment, VkExtent2D extent);
+    bool init(Device* device, VkRenderPass renderPass, VkImageView attachment, VkExtent2D extent);
+    // Frames in flight may still render into the framebuffer, it is destroyed once they completed
     void destroy();
 
     VkFramebuffer getVkFramebuffer() const { return m_framebuffer; }
 
 private:
-    VkDevice m_device;
-    VkFramebuffer m_framebuffer;
+    Device* m_device = nullptr;
+    VkFramebuffer m_framebuffer = VK_NULL_HANDLE;
 };
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include "gpuprofiler.h"
+#include "vulkanhelper.h"
+#include "device.h"
+#include "trace.h"
+
+#include <limits>
+
+void GpuProfiler::init(Device* device, uint32_t slotCount, uint32_t maxScopes)
+{
+    m_device = device;
+    m_maxScopes = maxScopes;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_device->getVkPysicalDevice(), &properties);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(m_device->getVkPysicalDevice(), &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(m_device->getVkPysicalDevice(), &queueFamilyCount, queueFamilies.data());
+
+    const uint32_t validBits = queueFamilies[m_device->getGraphicsQueueFamilyIndex()].timestampValidBits;
+    if (validBits == 0)
+    {
+        std::cout << "The graphics queue doesn't support timestamps, GPU profiling is disabled" << std::endl;
+        return;
+    }
+
+    m_timestampMask = validBits >= 64 ? std::numeric_limits<uint64_t>::max() : (1ull << validBits) - 1;
+    m_timestampPeriod = properties.limits.timestampPeriod;
+
+    m_slots.resize(slotCount);
+    for (auto& slot : m_slots)
+    {
+        createQueryPool(slot);
+    }
+
+    calibrate();
+}
+
+void GpuProfiler::createQueryPool(Slot& slot)
+{
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2 * m_maxScopes;
+
+    VK_CHECK_RESULT(vkCreateQueryPool(m_device->getVkDevice(), &queryPoolInfo, nullptr, &slot.queryPool));
+    slot.scopes.reserve(m_maxScopes);
+}
+
+void GpuProfiler::destroy()
+{
+    for (auto& slot : m_slots)
+    {
+        vkDestroyQueryPool(m_device->getVkDevice(), slot.queryPool, nullptr);
+    }
+    m_slots.clear();
+    m_results.clear();
+    m_recordingSlot = nullptr;
+}
+
+void GpuProfiler::resize(uint32_t slotCount)
+{
+    // without timestamp support there are no slots to resize
+    if (!isSupported() || slotCount == m_slots.size())
+        return;
+
+    assert(m_openScopes.empty());
+
+    for (size_t i = slotCount; i < m_slots.size(); ++i)
+    {
+        m_device->getDeletionQueue().destroyQueryPool(m_slots[i].queryPool);
+    }
+
+    // the remaining slots keep their pools and pending results
+    const size_t oldCount = m_slots.size();
+    m_slots.resize(slotCount);
+    for (size_t i = oldCount; i < m_slots.size(); ++i)
+    {
+        createQueryPool(m_slots[i]);
+    }
+    m_recordingSlot = nullptr;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+    assert(m_openScopes.empty());
+
+    // the renderer resizes the profiler with the swap chain, slots beyond that aren't profiled
+    if (slot >= m_slots.size())
+    {
+        m_recordingSlot = nullptr;
+        return;
+    }
+
+    m_recordingSlot = &m_slots[slot];
+    m_recordingSlot->scopes.clear();
+    m_recordingSlot->submitted = false;
+
+    vkCmdResetQueryPool(commandBuffer, m_recordingSlot->queryPool, 0, 2 * m_maxScopes);
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+    if (!m_recordingSlot || m_recordingSlot->scopes.size() == m_maxScopes)
+    {
+        // keep begin and end balanced for scopes that aren't recorded
+        m_openScopes.push_back(UINT32_MAX);
+        return;
+    }
+
+    const uint32_t index = static_cast<uint32_t>(m_recordingSlot->scopes.size());
+    m_recordingSlot->scopes.push_back({ name, static_cast<uint32_t>(m_openScopes.size()) });
+    m_openScopes.push_back(index);
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_recordingSlot->queryPool, 2 * index);
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer)
+{
+    assert(!m_openScopes.empty());
+
+    const uint32_t index = m_openScopes.back();
+    m_openScopes.pop_back();
+
+    if (index == UINT32_MAX)
+        return;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_recordingSlot->queryPool, 2 * index + 1);
+}
+
+void GpuProfiler::markSubmitted(uint32_t slot)
+{
+    if (slot < m_slots.size())
+    {
+        m_slots[slot].submitted = true;
+    }
+}
+
+void GpuProfiler::collect(uint32_t slot)
+{
+    if (slot >= m_slots.size())
+        return;
+
+    Slot& current = m_slots[slot];
+    if (!current.submitted || current.scopes.empty())
+        return;
+
+    // a prerecorded command buffer is submitted again, its results only count once
+    current.submitted = false;
+
+    const uint32_t queryCount = 2 * static_cast<uint32_t>(current.scopes.size());
+
+    // every result is followed by its availability
+    std::vector<uint64_t> data(2 * queryCount);
+    const VkResult result = vkGetQueryPoolResults(m_device->getVkDevice(), current.queryPool, 0, queryCount,
+        data.size() * sizeof(uint64_t), data.data(), 2 * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    if (result != VK_SUCCESS && result != VK_NOT_READY)
+    {
+        VK_CHECK_RESULT(result);
+    }
+
+    for (uint32_t i = 0; i < queryCount; ++i)
+    {
+        if (data[2 * i + 1] == 0)
+            return;
+    }
+
+    const uint64_t frameBegin = data[0] & m_timestampMask;
+    const double ticksToMilliseconds = m_timestampPeriod / 1000000.0;
+
+    m_results.resize(current.scopes.size());
+    for (size_t i = 0; i < current.scopes.size(); ++i)
+    {
+        const uint64_t begin = data[4 * i] & m_timestampMask;
+        const uint64_t end = data[4 * i + 2] & m_timestampMask;
+
+        Scope& scope = m_results[i];
+        scope.name = current.scopes[i].name;
+        scope.depth = current.scopes[i].depth;
+        scope.beginTime = ((begin - frameBegin) & m_timestampMask) * ticksToMilliseconds;
+        scope.duration = ((end - begin) & m_timestampMask) * ticksToMilliseconds;
+        scope.cpuBeginTime = toCpuTime(begin);
+
+        if (trace::isRecording())
+        {
+            trace::addGpuZone(current.scopes[i].name, scope.cpuBeginTime, toCpuTime(end));
+        }
+    }
+    m_resultCount++;
+}
+
+double GpuProfiler::getScopeTime(const std::string& name) const
+{
+    double time = 0.0;
+    for (const auto& scope : m_results)
+    {
+        if (scope.name == name)
+            time += scope.duration;
+    }
+    return time;
+}
+
+void GpuProfiler::calibrate()
+{
+    if (m_slots.empty())
+        return;
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 1;
+
+    VkQueryPool queryPool;
+    VK_CHECK_RESULT(vkCreateQueryPool(m_device->getVkDevice(), &queryPoolInfo, nullptr, &queryPool));
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = m_device->getCommandPool();
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(m_device->getVkDevice(), &allocInfo, &commandBuffer));
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, 1);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    // the timestamp is taken somewhere between submitting and the fence signaling,
+    // the sample with the shortest round trip has the smallest error
+    int64_t bestLatency = std::numeric_limits<int64_t>::max();
+    for (uint32_t i = 0; i < 5; ++i)
+    {
+        const int64_t before = trace::now();
+        m_device->waitForSubmission(m_device->submit(m_device->getGraphicsQueue(), submitInfo));
+        const int64_t after = trace::now();
+
+        uint64_t timestamp = 0;
+        VK_CHECK_RESULT(vkGetQueryPoolResults(m_device->getVkDevice(), queryPool, 0, 1, sizeof(timestamp), &timestamp, sizeof(timestamp),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+        if (after - before < bestLatency)
+        {
+            bestLatency = after - before;
+            m_calibrationTimestamp = timestamp & m_timestampMask;
+            m_calibrationCpuTime = before + (after - before) / 2;
+        }
+    }
+
+    vkFreeCommandBuffers(m_device->getVkDevice(), m_device->getCommandPool(), 1, &commandBuffer);
+    vkDestroyQueryPool(m_device->getVkDevice(), queryPool, nullptr);
+}
+
+int64_t GpuProfiler::toCpuTime(uint64_t timestamp) const
+{
+    // the difference of two masked timestamps wraps around within the valid bits
+    uint64_t ticks = (timestamp - m_calibrationTimestamp) & m_timestampMask;
+    double sign = 1.0;
+    if (ticks > m_timestampMask / 2)
+    {
+        ticks = (m_calibrationTimestamp - timestamp) & m_timestampMask;
+        sign = -1.0;
+    }
+    return m_calibrationCpuTime + static_cast<int64_t>(sign * ticks * m_timestampPeriod);
+}
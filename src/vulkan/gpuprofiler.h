@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Device;
+
+// Measures named, nestable scopes of command buffers with timestamp queries.
+// Every slot, i.e. a frame in flight or a prerecorded per image command buffer, has its own query pool.
+// Results of a slot are read back before it is recorded or submitted again. By then its fence signaled,
+// so reading never waits; results that still aren't available are dropped instead.
+class GpuProfiler
+{
+public:
+    static const uint32_t DefaultMaxScopes = 128;
+
+    struct Scope
+    {
+        std::string name;
+        // 0 for scopes that aren't nested in another one
+        uint32_t depth = 0;
+        // relative to the begin of the first scope of the frame
+        double beginTime = 0.0;
+        double duration = 0.0;
+        // begin on the CPU clock of trace::now
+        int64_t cpuBeginTime = 0;
+    };
+
+    void init(Device* device, uint32_t slotCount, uint32_t maxScopes = DefaultMaxScopes);
+    void destroy();
+    // Adds or removes slots at the end, e.g. when the swap chain got a different number of images.
+    // Query pools of removed slots may still be used by frames in flight and go through the deletion queue.
+    void resize(uint32_t slotCount);
+
+    bool isSupported() const { return !m_slots.empty(); }
+
+    // Starts recording the scopes of slot into commandBuffer, has to be called outside of a render pass
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t slot);
+    // Scopes can be nested and may be inside or outside of render passes, but only in primary command buffers.
+    // name has to outlive the frame.
+    void beginScope(VkCommandBuffer commandBuffer, const char* name);
+    void endScope(VkCommandBuffer commandBuffer);
+
+    // Reads the results of the last submission of slot, which has to be complete
+    void collect(uint32_t slot);
+    // Has to be called for every submission of slot, after the slot was recorded
+    void markSubmitted(uint32_t slot);
+
+    // Scopes of the most recently collected frame in the order they began, times in milliseconds
+    const std::vector<Scope>& getResults() const { return m_results; }
+    // Sum of the durations of all scopes called name in the most recently collected frame, 0 if there is none
+    double getScopeTime(const std::string& name) const;
+    // Incremented with every collected frame
+    uint64_t getResultCount() const { return m_resultCount; }
+
+    // Pairs a GPU timestamp with the CPU clock, repeated a few times to pick the sample with the lowest latency.
+    // Without VK_EXT_calibrated_timestamps both clocks drift apart slowly, calibrate again to compensate.
+    void calibrate();
+    int64_t toCpuTime(uint64_t timestamp) const;
+
+private:
+    struct RecordedScope
+    {
+        const char* name;
+        uint32_t depth;
+    };
+
+    struct Slot
+    {
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        std::vector<RecordedScope> scopes;
+        bool submitted = false;
+    };
+
+    void createQueryPool(Slot& slot);
+
+    Device* m_device = nullptr;
+    uint32_t m_maxScopes = 0;
+    uint64_t m_timestampMask = 0;
+    double m_timestampPeriod = 0.0;
+
+    std::vector<Slot> m_slots;
+    // slot and open scopes of the command buffer that is being recorded
+    Slot* m_recordingSlot = nullptr;
+    std::vector<uint32_t> m_openScopes;
+
+    std::vector<Scope> m_results;
+    uint64_t m_resultCount = 0;
+
+    uint64_t m_calibrationTimestamp = 0;
+    int64_t m_calibrationCpuTime = 0;
+};
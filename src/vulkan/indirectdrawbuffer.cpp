@@ -0,0 +1,69 @@
+#include "indirectdrawbuffer.h"
+#include "vulkanhelper.h"
+#include "device.h"
+#include "uploadbatch.h"
+
+#include <algorithm>
+
+void IndirectDrawBuffer::init(Device* device, const std::vector<VkDrawIndexedIndirectCommand>& commands, UploadBatch* uploadBatch)
+{
+    assert(!commands.empty());
+
+    m_device = device;
+    m_commandCount = static_cast<uint32_t>(commands.size());
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_device->getVkPysicalDevice(), &properties);
+    m_maxDrawCount = m_device->getEnabledFeatures().multiDrawIndirect ? std::max(properties.limits.maxDrawIndirectCount, 1u) : 1;
+
+    if (!m_device->getEnabledFeatures().drawIndirectFirstInstance)
+    {
+        for (const auto& command : commands)
+        {
+            assert(command.firstInstance == 0 && "drawIndirectFirstInstance is not supported");
+        }
+    }
+
+    const uint32_t size = m_commandCount * sizeof(VkDrawIndexedIndirectCommand);
+    m_device->createBuffer(size,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        m_buffer, m_memory);
+
+    if (uploadBatch)
+    {
+        memcpy(uploadBatch->uploadBuffer(m_buffer, size), commands.data(), size);
+    }
+    else
+    {
+        UploadBatch batch;
+        batch.begin(m_device);
+        memcpy(batch.uploadBuffer(m_buffer, size), commands.data(), size);
+        batch.submit();
+        batch.wait();
+    }
+    m_device->recordUpload("indirect buffer", UploadPath::Staged, size);
+}
+
+void IndirectDrawBuffer::destroy()
+{
+    if (m_buffer != VK_NULL_HANDLE)
+    {
+        m_device->getDeletionQueue().destroyBuffer(m_buffer, m_memory);
+        m_buffer = VK_NULL_HANDLE;
+        m_memory = MemoryAllocation();
+    }
+    m_commandCount = 0;
+}
+
+void IndirectDrawBuffer::draw(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count) const
+{
+    assert(first + count <= m_commandCount);
+
+    const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+    for (uint32_t command = first; command < first + count; command += m_maxDrawCount)
+    {
+        const uint32_t drawCount = std::min(m_maxDrawCount, first + count - command);
+        vkCmdDrawIndexedIndirect(commandBuffer, m_buffer, command * stride, drawCount, static_cast<uint32_t>(stride));
+    }
+}
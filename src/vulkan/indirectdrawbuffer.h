@@ -0,0 +1,40 @@
+#pragma once
+
+#include "memoryallocator.h"
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+class Device;
+class UploadBatch;
+
+// Draw arguments for vkCmdDrawIndexedIndirect in device local memory, for many meshes that share the vertex
+// and index buffers of one VertexBuffer and differ in firstIndex, vertexOffset and their instances.
+// With the multiDrawIndirect feature any number of consecutive commands is one call, so recording costs the same
+// for ten objects and ten thousand; without it every command is a call of its own, which still saves binding state.
+// The buffer has STORAGE_BUFFER usage as well, so a compute shader can write the commands, e.g. to cull objects.
+class IndirectDrawBuffer
+{
+public:
+    // Without an upload batch the commands are uploaded right away and the call blocks until the copy finished
+    void init(Device* device, const std::vector<VkDrawIndexedIndirectCommand>& commands, UploadBatch* uploadBatch = nullptr);
+    // Frames in flight may still read the buffer, it is destroyed once they completed
+    void destroy();
+
+    // Draws the commands [first, first + count), the pipeline, vertex and index buffers have to be bound
+    void draw(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count) const;
+    void draw(VkCommandBuffer commandBuffer) const { draw(commandBuffer, 0, m_commandCount); }
+
+    VkBuffer getBuffer() const { return m_buffer; }
+    uint32_t getCommandCount() const { return m_commandCount; }
+    // Whether draw issues one call for many commands
+    bool isMultiDraw() const { return m_maxDrawCount > 1; }
+
+private:
+    Device* m_device = nullptr;
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_memory;
+    uint32_t m_commandCount = 0;
+    // commands per call, 1 without multiDrawIndirect
+    uint32_t m_maxDrawCount = 1;
+};
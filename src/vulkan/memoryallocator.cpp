@@ -0,0 +1,358 @@
+#include "memoryallocator.h"
+#include "vulkanhelper.h"
+
+#include <algorithm>
+
+void MemoryAllocator::init(VkDevice device, VkPhysicalDevice physicalDevice, const MemoryTypeTable& memoryTypes, VkDeviceSize blockSize)
+{
+    m_device = device;
+    m_memoryTypes = &memoryTypes;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    // Buffers and optimal tiled images may not share a page of bufferImageGranularity bytes,
+    // keeping them in different blocks is simpler than padding every neighbouring allocation
+    m_separateLinearPools = properties.limits.bufferImageGranularity > 1;
+    m_nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+
+    m_heapUsage.assign(memoryTypes.getHeapCount(), 0);
+
+    m_pools.resize(memoryTypes.getTypeCount() * 2);
+    for (uint32_t i = 0; i < memoryTypes.getTypeCount(); i++)
+    {
+        // don't let a single block take more than an eighth of small heaps
+        const VkDeviceSize heapSize = memoryTypes.getHeapSize(memoryTypes.getHeapIndex(i));
+        VkDeviceSize poolBlockSize = MinAllocationSize;
+        while (poolBlockSize * 2 <= blockSize && poolBlockSize * 2 <= heapSize / 8)
+        {
+            poolBlockSize *= 2;
+        }
+
+        m_pools[i * 2].blockSize = poolBlockSize;
+        m_pools[i * 2 + 1].blockSize = poolBlockSize;
+    }
+}
+
+void MemoryAllocator::destroy()
+{
+    for (auto& pool : m_pools)
+    {
+        for (auto& block : pool.blocks)
+        {
+            if (block->allocationCount > 0)
+            {
+                std::cout << "Warning: destroying memory block with " << block->allocationCount << " allocations still alive" << std::endl;
+            }
+            destroyBlock(block.get());
+        }
+    }
+    m_pools.clear();
+
+    if (m_dedicatedAllocationCount > 0)
+    {
+        std::cout << "Warning: " << m_dedicatedAllocationCount << " dedicated allocations were not freed" << std::endl;
+    }
+}
+
+bool MemoryAllocator::allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool linear, MemoryAllocation& allocation)
+{
+    if (memoryTypeIndex * 2 >= m_pools.size())
+        return false;
+
+    // Ranges of the buddy allocator are aligned to their own size, so aligning is just rounding up
+    const uint32_t poolIndex = memoryTypeIndex * 2 + ((m_separateLinearPools && !linear) ? 1 : 0);
+    Pool& pool = m_pools[poolIndex];
+    const uint32_t order = getOrder(std::max(requirements.size, requirements.alignment));
+    const VkDeviceSize rangeSize = MinAllocationSize << order;
+
+    // Large resources would waste most of a block, give them their own memory
+    if (rangeSize > pool.blockSize / 2)
+        return allocateDedicated(requirements.size, memoryTypeIndex, allocation);
+
+    VkDeviceSize offset = 0;
+    MemoryBlock* block = nullptr;
+    for (auto& poolBlock : pool.blocks)
+    {
+        if (allocateFromBlock(*poolBlock, order, offset))
+        {
+            block = poolBlock.get();
+            break;
+        }
+    }
+
+    if (!block)
+    {
+        block = createBlock(pool, memoryTypeIndex);
+        if (!block)
+            return allocateDedicated(requirements.size, memoryTypeIndex, allocation);
+
+        block->poolIndex = poolIndex;
+        allocateFromBlock(*block, order, offset);
+    }
+
+    block->allocationCount++;
+    block->usedBytes += rangeSize;
+    block->requestedBytes += requirements.size;
+
+    allocation.memory = block->memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.mappedData = block->mappedData ? static_cast<uint8_t*>(block->mappedData) + offset : nullptr;
+    allocation.block = block;
+    allocation.order = order;
+
+    return true;
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    if (allocation.block == nullptr)
+    {
+        vkFreeMemory(m_device, allocation.memory, nullptr);
+        m_dedicatedAllocationCount--;
+        m_dedicatedBytes -= allocation.size;
+        m_heapUsage[m_memoryTypes->getHeapIndex(allocation.memoryTypeIndex)] -= allocation.size;
+    }
+    else
+    {
+        MemoryBlock* block = allocation.block;
+        freeToBlock(*block, allocation.order, allocation.offset);
+        block->allocationCount--;
+        block->usedBytes -= MinAllocationSize << allocation.order;
+        block->requestedBytes -= allocation.size;
+
+        // keep one empty block per pool around to avoid allocation churn
+        Pool& pool = m_pools[block->poolIndex];
+        if (block->allocationCount == 0 && pool.blocks.size() > 1)
+        {
+            destroyBlock(block);
+            pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(),
+                [block](const std::unique_ptr<MemoryBlock>& poolBlock) { return poolBlock.get() == block; }));
+        }
+    }
+
+    allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkMappedMemoryRange range;
+    if (getMappedRange(allocation, offset, size, range))
+    {
+        VK_CHECK_RESULT(vkFlushMappedMemoryRanges(m_device, 1, &range));
+    }
+}
+
+void MemoryAllocator::invalidate(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkMappedMemoryRange range;
+    if (getMappedRange(allocation, offset, size, range))
+    {
+        VK_CHECK_RESULT(vkInvalidateMappedMemoryRanges(m_device, 1, &range));
+    }
+}
+
+bool MemoryAllocator::isCoherent(const MemoryAllocation& allocation) const
+{
+    return (m_memoryTypes->getTypeFlags(allocation.memoryTypeIndex) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+bool MemoryAllocator::getMappedRange(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange& range) const
+{
+    if (isCoherent(allocation))
+        return false;
+
+    assert(allocation.mappedData);
+    if (size == VK_WHOLE_SIZE)
+    {
+        size = allocation.size - offset;
+    }
+    if (size == 0)
+        return false;
+
+    // rounding out may touch neighbouring allocations of the block, which is harmless
+    const VkDeviceSize memorySize = allocation.block ? allocation.block->size : allocation.size;
+    const VkDeviceSize begin = (allocation.offset + offset) / m_nonCoherentAtomSize * m_nonCoherentAtomSize;
+    const VkDeviceSize end = (allocation.offset + offset + size + m_nonCoherentAtomSize - 1) / m_nonCoherentAtomSize * m_nonCoherentAtomSize;
+
+    range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.memory;
+    range.offset = begin;
+    // the end of the memory object needs no alignment
+    range.size = end >= memorySize ? VK_WHOLE_SIZE : end - begin;
+    return true;
+}
+
+MemoryAllocator::Statistics MemoryAllocator::getStatistics() const
+{
+    Statistics stats;
+    stats.dedicatedAllocationCount = m_dedicatedAllocationCount;
+    stats.allocationCount = m_dedicatedAllocationCount;
+    stats.allocatedBytes = m_dedicatedBytes;
+    stats.usedBytes = m_dedicatedBytes;
+    stats.requestedBytes = m_dedicatedBytes;
+
+    VkDeviceSize freeBytes = 0;
+    VkDeviceSize largestRangesBytes = 0;
+    for (const auto& pool : m_pools)
+    {
+        for (const auto& block : pool.blocks)
+        {
+            stats.blockCount++;
+            stats.allocationCount += block->allocationCount;
+            stats.allocatedBytes += block->size;
+            stats.usedBytes += block->usedBytes;
+            stats.requestedBytes += block->requestedBytes;
+
+            VkDeviceSize largestBlockRange = 0;
+            for (uint32_t order = 0; order <= block->maxOrder; order++)
+            {
+                const auto& freeList = block->freeLists[order];
+                if (!freeList.empty())
+                {
+                    freeBytes += freeList.size() * (MinAllocationSize << order);
+                    largestBlockRange = MinAllocationSize << order;
+                }
+            }
+            largestRangesBytes += largestBlockRange;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, largestBlockRange);
+        }
+    }
+
+    // share of free memory that is not part of the largest free range of its block
+    if (freeBytes > 0)
+    {
+        stats.fragmentation = 1.0f - static_cast<float>(largestRangesBytes) / static_cast<float>(freeBytes);
+    }
+
+    return stats;
+}
+
+void* MemoryAllocator::mapMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex)
+{
+    if ((m_memoryTypes->getTypeFlags(memoryTypeIndex) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
+        return nullptr;
+
+    void* data = nullptr;
+    VK_CHECK_RESULT(vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &data));
+    return data;
+}
+
+bool MemoryAllocator::allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex, MemoryAllocation& allocation)
+{
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        return false;
+    void* mappedData = mapMemory(memory, memoryTypeIndex);
+
+    m_dedicatedAllocationCount++;
+    m_dedicatedBytes += size;
+    m_heapUsage[m_memoryTypes->getHeapIndex(memoryTypeIndex)] += size;
+
+    allocation.memory = memory;
+    allocation.offset = 0;
+    allocation.size = size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.mappedData = mappedData;
+    allocation.block = nullptr;
+    allocation.order = 0;
+
+    return true;
+}
+
+MemoryBlock* MemoryAllocator::createBlock(Pool& pool, uint32_t memoryTypeIndex)
+{
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = pool.blockSize;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        return nullptr;
+
+    m_heapUsage[m_memoryTypes->getHeapIndex(memoryTypeIndex)] += pool.blockSize;
+
+    std::unique_ptr<MemoryBlock> block(new MemoryBlock);
+    block->memory = memory;
+    block->mappedData = mapMemory(memory, memoryTypeIndex);
+    block->size = pool.blockSize;
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->maxOrder = getOrder(pool.blockSize);
+    block->freeLists.resize(block->maxOrder + 1);
+    block->freeLists[block->maxOrder].insert(0);
+
+    pool.blocks.push_back(std::move(block));
+    return pool.blocks.back().get();
+}
+
+void MemoryAllocator::destroyBlock(MemoryBlock* block)
+{
+    // freeing memory implicitly unmaps it
+    vkFreeMemory(m_device, block->memory, nullptr);
+    block->memory = VK_NULL_HANDLE;
+    block->mappedData = nullptr;
+    m_heapUsage[m_memoryTypes->getHeapIndex(block->memoryTypeIndex)] -= block->size;
+}
+
+bool MemoryAllocator::allocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset)
+{
+    // find the smallest free range that is large enough
+    uint32_t freeOrder = order;
+    while (freeOrder <= block.maxOrder && block.freeLists[freeOrder].empty())
+    {
+        freeOrder++;
+    }
+    if (freeOrder > block.maxOrder)
+        return false;
+
+    offset = *block.freeLists[freeOrder].begin();
+    block.freeLists[freeOrder].erase(block.freeLists[freeOrder].begin());
+
+    // split it in halves until it has the requested size, the upper halves become free
+    while (freeOrder > order)
+    {
+        freeOrder--;
+        block.freeLists[freeOrder].insert(offset + (MinAllocationSize << freeOrder));
+    }
+
+    return true;
+}
+
+void MemoryAllocator::freeToBlock(MemoryBlock& block, uint32_t order, VkDeviceSize offset)
+{
+    // merge with the buddy range as long as it is free as well
+    while (order < block.maxOrder)
+    {
+        const VkDeviceSize buddy = offset ^ (MinAllocationSize << order);
+        auto it = block.freeLists[order].find(buddy);
+        if (it == block.freeLists[order].end())
+            break;
+
+        block.freeLists[order].erase(it);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    block.freeLists[order].insert(offset);
+}
+
+uint32_t MemoryAllocator::getOrder(VkDeviceSize size)
+{
+    uint32_t order = 0;
+    while ((MinAllocationSize << order) < size)
+    {
+        order++;
+    }
+    return order;
+}
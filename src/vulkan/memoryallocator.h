@@ -0,0 +1,116 @@
+#pragma once
+
+#include "memorytypes.h"
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <set>
+#include <memory>
+
+struct MemoryBlock;
+
+struct MemoryAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeIndex = UINT32_MAX;
+    // host visible memory stays mapped as long as it is allocated, nullptr for other memory types
+    void* mappedData = nullptr;
+
+    // nullptr for dedicated allocations that own their VkDeviceMemory
+    MemoryBlock* block = nullptr;
+    uint32_t order = 0;
+};
+
+// Sub-allocates resources from large VkDeviceMemory blocks with a buddy allocator.
+// There is one pool of blocks per memory type; if the device has a bufferImageGranularity > 1
+// linear (buffers) and optimal tiled (images) resources get separate pools so they never share a page.
+// Host visible blocks and dedicated allocations are mapped once when they are allocated,
+// every allocation gets a pointer into that mapping instead of mapping memory per write.
+class MemoryAllocator
+{
+public:
+    static const VkDeviceSize DefaultBlockSize = 64 * 1024 * 1024;
+    static const VkDeviceSize MinAllocationSize = 256;
+
+    struct Statistics
+    {
+        uint32_t blockCount = 0;
+        uint32_t dedicatedAllocationCount = 0;
+        uint32_t allocationCount = 0;
+        // memory allocated from the driver (blocks and dedicated allocations)
+        VkDeviceSize allocatedBytes = 0;
+        // bytes handed out to resources including the power of two rounding of the buddy allocator
+        VkDeviceSize usedBytes = 0;
+        // bytes requested by resources
+        VkDeviceSize requestedBytes = 0;
+        VkDeviceSize largestFreeRange = 0;
+        // 0 if the free memory of each block is one contiguous range, approaches 1 the more it is split up
+        float fragmentation = 0.0f;
+    };
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, const MemoryTypeTable& memoryTypes, VkDeviceSize blockSize = DefaultBlockSize);
+    void destroy();
+
+    bool allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool linear, MemoryAllocation& allocation);
+    void free(MemoryAllocation& allocation);
+
+    // Without HOST_COHERENT, host writes have to be flushed before the device reads them and device writes
+    // invalidated before the host reads them. Both take a range of the allocation, round it out to
+    // nonCoherentAtomSize and do nothing for coherent memory.
+    void flush(const MemoryAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    void invalidate(const MemoryAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    bool isCoherent(const MemoryAllocation& allocation) const;
+
+    Statistics getStatistics() const;
+    // Bytes allocated from the driver per memory heap, blocks and dedicated allocations
+    const std::vector<VkDeviceSize>& getHeapUsage() const { return m_heapUsage; }
+
+private:
+    struct Pool
+    {
+        VkDeviceSize blockSize = 0;
+        std::vector<std::unique_ptr<MemoryBlock>> blocks;
+    };
+
+    void* mapMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex);
+    bool allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex, MemoryAllocation& allocation);
+    MemoryBlock* createBlock(Pool& pool, uint32_t memoryTypeIndex);
+    void destroyBlock(MemoryBlock* block);
+
+    bool getMappedRange(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange& range) const;
+
+    static bool allocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset);
+    static void freeToBlock(MemoryBlock& block, uint32_t order, VkDeviceSize offset);
+    static uint32_t getOrder(VkDeviceSize size);
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    const MemoryTypeTable* m_memoryTypes = nullptr;
+    bool m_separateLinearPools = false;
+    VkDeviceSize m_nonCoherentAtomSize = 1;
+    std::vector<Pool> m_pools;
+
+    uint32_t m_dedicatedAllocationCount = 0;
+    VkDeviceSize m_dedicatedBytes = 0;
+    std::vector<VkDeviceSize> m_heapUsage;
+};
+
+struct MemoryBlock
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeIndex = UINT32_MAX;
+    uint32_t poolIndex = 0;
+    uint32_t maxOrder = 0;
+
+    // free offsets per order, a range of order n is MinAllocationSize << n bytes large
+    std::vector<std::set<VkDeviceSize>> freeLists;
+
+    uint32_t allocationCount = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize requestedBytes = 0;
+
+    // mapping of the whole block if it is host visible
+    void* mappedData = nullptr;
+};
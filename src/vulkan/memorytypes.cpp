@@ -0,0 +1,84 @@
+#include "memorytypes.h"
+#include "vulkanhelper.h"
+
+#include <algorithm>
+#include <bitset>
+
+namespace
+{
+    uint32_t countFlags(VkMemoryPropertyFlags flags)
+    {
+        return static_cast<uint32_t>(std::bitset<32>(flags).count());
+    }
+}
+
+void MemoryTypeTable::init(VkPhysicalDevice physicalDevice)
+{
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_properties);
+
+    m_candidates.assign(1u << (2 * FlagBits), Candidates());
+    for (VkMemoryPropertyFlags required = 0; required <= FlagMask; required++)
+    {
+        for (VkMemoryPropertyFlags preferred = 0; preferred <= FlagMask; preferred++)
+        {
+            std::vector<uint32_t> types;
+            for (uint32_t i = 0; i < m_properties.memoryTypeCount; i++)
+            {
+                if ((getTypeFlags(i) & required) == required)
+                    types.push_back(i);
+            }
+
+            // ties keep the order of the driver, which lists faster types first
+            std::stable_sort(types.begin(), types.end(), [&](uint32_t a, uint32_t b)
+            {
+                const VkMemoryPropertyFlags flagsA = getTypeFlags(a) & FlagMask;
+                const VkMemoryPropertyFlags flagsB = getTypeFlags(b) & FlagMask;
+
+                const uint32_t preferredA = countFlags(flagsA & preferred);
+                const uint32_t preferredB = countFlags(flagsB & preferred);
+                if (preferredA != preferredB)
+                    return preferredA > preferredB;
+
+                const uint32_t unwantedA = countFlags(flagsA & ~(required | preferred));
+                const uint32_t unwantedB = countFlags(flagsB & ~(required | preferred));
+                if (unwantedA != unwantedB)
+                    return unwantedA < unwantedB;
+
+                return getHeapSize(getHeapIndex(a)) > getHeapSize(getHeapIndex(b));
+            });
+
+            Candidates& candidates = m_candidates[getKey(required, preferred)];
+            candidates.count = static_cast<uint8_t>(types.size());
+            std::copy(types.begin(), types.end(), candidates.types);
+        }
+    }
+}
+
+uint32_t MemoryTypeTable::find(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+    VkDeviceSize size, const std::vector<VkDeviceSize>* heapUsage) const
+{
+    assert((required & ~FlagMask) == 0);
+
+    const Candidates& candidates = m_candidates[getKey(required, preferred)];
+
+    uint32_t overBudget = UINT32_MAX;
+    for (uint32_t i = 0; i < candidates.count; i++)
+    {
+        const uint32_t type = candidates.types[i];
+        if ((typeBits & (1u << type)) == 0)
+            continue;
+
+        if (!heapUsage)
+            return type;
+
+        const uint32_t heap = getHeapIndex(type);
+        if ((*heapUsage)[heap] + size <= getHeapBudget(heap))
+            return type;
+
+        if (overBudget == UINT32_MAX)
+            overBudget = type;
+    }
+
+    // exceeding the budget may still work, failing outright would not
+    return overBudget;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+// Memory properties of a physical device, queried once, with the memory types ranked up front
+// for every combination of required and preferred property flags.
+// A lookup indexes the ranking directly and takes the first candidate allowed by the type bits of a resource,
+// so it never touches more than VK_MAX_MEMORY_TYPES entries.
+class MemoryTypeTable
+{
+public:
+    // Without VK_EXT_memory_budget only this share of a heap is considered available to the application
+    static const uint32_t HeapBudgetPercent = 80;
+
+    void init(VkPhysicalDevice physicalDevice);
+
+    // Best memory type in typeBits with all required flags, ranked by
+    //   1. the number of preferred flags it has
+    //   2. the number of flags it has that were neither required nor preferred, e.g. no DEVICE_LOCAL for staging memory
+    //   3. the size of its heap
+    // Types whose heap budget has no room for size bytes more than heapUsage are skipped as long as another one fits.
+    // Returns UINT32_MAX if no type has the required flags.
+    uint32_t find(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0,
+        VkDeviceSize size = 0, const std::vector<VkDeviceSize>* heapUsage = nullptr) const;
+
+    // True if any memory type has all flags
+    bool hasType(VkMemoryPropertyFlags flags) const { return find(UINT32_MAX, flags) != UINT32_MAX; }
+
+    const VkPhysicalDeviceMemoryProperties& getProperties() const { return m_properties; }
+    uint32_t getTypeCount() const { return m_properties.memoryTypeCount; }
+    uint32_t getHeapCount() const { return m_properties.memoryHeapCount; }
+    VkMemoryPropertyFlags getTypeFlags(uint32_t typeIndex) const { return m_properties.memoryTypes[typeIndex].propertyFlags; }
+    uint32_t getHeapIndex(uint32_t typeIndex) const { return m_properties.memoryTypes[typeIndex].heapIndex; }
+    VkDeviceSize getHeapSize(uint32_t heapIndex) const { return m_properties.memoryHeaps[heapIndex].size; }
+    VkDeviceSize getHeapBudget(uint32_t heapIndex) const { return getHeapSize(heapIndex) / 100 * HeapBudgetPercent; }
+
+private:
+    // DEVICE_LOCAL, HOST_VISIBLE, HOST_COHERENT, HOST_CACHED and LAZILY_ALLOCATED
+    static const uint32_t FlagBits = 5;
+    static const VkMemoryPropertyFlags FlagMask = (1u << FlagBits) - 1;
+
+    struct Candidates
+    {
+        uint8_t count = 0;
+        uint8_t types[VK_MAX_MEMORY_TYPES];
+    };
+
+    static uint32_t getKey(VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
+    {
+        return (required & FlagMask) | ((preferred & FlagMask) << FlagBits);
+    }
+
+    VkPhysicalDeviceMemoryProperties m_properties = {};
+    // indexed by getKey
+    std::vector<Candidates> m_candidates;
+};
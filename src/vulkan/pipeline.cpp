@@ -1,6 +1,7 @@
 #include "pipeline.h"
 #include "vulkanhelper.h"
 #include "vertexbuffer.h"
+#include "device.h"
 
 void PipelineLayout::init(VkDevice device, const std::vector<VkDescriptorSetLayout>& layouts)
 {
@@ -91,7 +92,7 @@ PipelineSettings::PipelineSettings()
 
 //////////////////////////////////////////////////////////////////////////
 
-bool Pipeline::init(VkDevice device,
+bool Pipeline::init(Device* device,
     VkRenderPass renderPass,
     VkPipelineLayout layout,
     const PipelineSettings& settings,
@@ -126,13 +127,14 @@ bool Pipeline::init(VkDevice device,
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    VK_CHECK_RESULT(vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_pipeline));
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(m_device->getVkDevice(), device->getPipelineCache(), 1, &pipelineInfo, nullptr, &m_pipeline));
 
     return true;
 }
 
 void Pipeline::destroy()
 {
-    vkDestroyPipeline(m_device, m_pipeline, nullptr);
+    // frames in flight may still use the pipeline
+    m_device->getDeletionQueue().destroyPipeline(m_pipeline);
     m_pipeline = VK_NULL_HANDLE;
 }
@@ -32,12 +32,14 @@ public:
     static VkDynamicState dynamicStates[2];
 };
 
+class Device;
 class VertexBuffer;
 
 class Pipeline
 {
 public:
-    bool init(VkDevice device,
+    // Pipelines are created through the pipeline cache of device
+    bool init(Device* device,
         VkRenderPass renderPass,
         VkPipelineLayout layout,
         const PipelineSettings& settings,
@@ -49,6 +51,6 @@ public:
     VkPipeline getVkPipeline() const { return m_pipeline; }
 
 private:
-    VkDevice m_device = VK_NULL_HANDLE;
+    Device* m_device = nullptr;
     VkPipeline m_pipeline = VK_NULL_HANDLE;
 };
\ No newline at end of file
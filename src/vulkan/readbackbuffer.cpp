@@ -0,0 +1,93 @@
+#include "readbackbuffer.h"
+#include "vulkanhelper.h"
+#include "device.h"
+
+void ReadbackBuffer::init(Device* device, VkDeviceSize size)
+{
+    m_device = device;
+    m_size = size;
+
+    m_device->createBuffer(static_cast<uint32_t>(m_size),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        m_buffer, m_memory,
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+    m_cached = (m_device->getMemoryFlags(m_memory) & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+    if (!m_cached)
+    {
+        std::cout << "Warning: no host cached memory for readbacks, reading them will be slow" << std::endl;
+    }
+
+    m_data = static_cast<const uint8_t*>(m_memory.mappedData);
+}
+
+void ReadbackBuffer::destroy()
+{
+    if (m_buffer == VK_NULL_HANDLE)
+        return;
+
+    m_device->getDeletionQueue().destroyBuffer(m_buffer, m_memory);
+
+    m_buffer = VK_NULL_HANDLE;
+    m_memory = MemoryAllocation();
+    m_data = nullptr;
+}
+
+void ReadbackBuffer::copyFromBuffer(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+{
+    assert(dstOffset + size <= m_size);
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(commandBuffer, srcBuffer, m_buffer, 1, &copyRegion);
+
+    hostBarrier(commandBuffer, dstOffset, size);
+}
+
+void ReadbackBuffer::copyFromImage(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, VkDeviceSize dstOffset)
+{
+    // RGBA8, the only format the renderer reads back
+    const VkDeviceSize size = static_cast<VkDeviceSize>(width) * height * 4;
+    assert(dstOffset + size <= m_size);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = dstOffset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { width, height, 1 };
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_buffer, 1, &region);
+
+    hostBarrier(commandBuffer, dstOffset, size);
+}
+
+void ReadbackBuffer::hostBarrier(VkCommandBuffer commandBuffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0,
+        0, nullptr,
+        1, &barrier,
+        0, nullptr);
+}
+
+const void* ReadbackBuffer::read(VkDeviceSize offset, VkDeviceSize size)
+{
+    assert(offset + size <= m_size);
+
+    // only the range that is read, for non coherent memory
+    m_device->invalidateMemory(m_memory, offset, size);
+    return m_data + offset;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "memoryallocator.h"
+
+#include <vulkan/vulkan.h>
+
+class Device;
+
+// Host visible buffer the GPU copies results into for the CPU to read, e.g. rendered images.
+// HOST_CACHED memory is preferred because reading uncached memory is very slow; without HOST_COHERENT
+// read invalidates the requested range first. The buffer is read through the persistent mapping of its memory.
+class ReadbackBuffer
+{
+public:
+    void init(Device* device, VkDeviceSize size);
+    // Frames in flight may still copy into the buffer, it is destroyed once they completed
+    void destroy();
+
+    // Both record the copy and a barrier that makes it visible to the host once the submission completed
+    void copyFromBuffer(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+    // The image has to be in TRANSFER_SRC_OPTIMAL, texels are written tightly packed
+    void copyFromImage(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, VkDeviceSize dstOffset = 0);
+
+    // Only valid after the submission with the copy completed
+    const void* read(VkDeviceSize offset, VkDeviceSize size);
+
+    VkBuffer getBuffer() const { return m_buffer; }
+    VkDeviceSize getSize() const { return m_size; }
+    bool isCached() const { return m_cached; }
+
+private:
+    void hostBarrier(VkCommandBuffer commandBuffer, VkDeviceSize offset, VkDeviceSize size);
+
+    Device* m_device = nullptr;
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_memory;
+    const uint8_t* m_data = nullptr;
+    VkDeviceSize m_size = 0;
+    bool m_cached = false;
+};
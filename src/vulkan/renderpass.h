@@ -5,7 +5,7 @@
 class RenderPass
 {
 public:
-    bool init(VkDevice device, VkFormat colorAttachmentFormat);
+    bool init(VkDevice device, VkFormat colorAttachmentFormat, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
     void destroy();
 
     VkRenderPass getVkRenderPass() const { return m_renderPass; }
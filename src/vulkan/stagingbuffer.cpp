@@ -0,0 +1,238 @@
+#include "stagingbuffer.h"
+#include "vulkanhelper.h"
+#include "device.h"
+#include "trace.h"
+
+#include <algorithm>
+
+namespace
+{
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return ((value + alignment - 1) / alignment) * alignment;
+    }
+}
+
+void StagingBuffer::init(Device* device, VkDeviceSize size)
+{
+    m_device = device;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_device->getVkPysicalDevice(), &properties);
+
+    // buffer to image copies need offsets that are a multiple of 4 and of the texel size
+    m_minAlignment = std::max<VkDeviceSize>(properties.limits.optimalBufferCopyOffsetAlignment, 4);
+
+    createBuffer(size);
+}
+
+void StagingBuffer::createBuffer(VkDeviceSize size)
+{
+    m_size = size;
+    m_device->createBuffer(static_cast<uint32_t>(m_size),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        m_buffer, m_memory,
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    m_data = static_cast<uint8_t*>(m_memory.mappedData);
+}
+
+void StagingBuffer::destroy()
+{
+    for (const auto& range : m_ranges)
+    {
+        if (range.submission != PendingSubmission)
+        {
+            m_device->waitForSubmission(range.submission);
+        }
+    }
+    m_ranges.clear();
+    m_head = 0;
+
+    for (auto& retired : m_retiredBuffers)
+    {
+        for (const auto& range : retired.ranges)
+        {
+            if (range.submission != PendingSubmission)
+            {
+                m_device->waitForSubmission(range.submission);
+            }
+        }
+        m_device->destroyBuffer(retired.buffer, retired.memory);
+    }
+    m_retiredBuffers.clear();
+
+    if (m_buffer != VK_NULL_HANDLE)
+    {
+        m_device->destroyBuffer(m_buffer, m_memory);
+        m_data = nullptr;
+    }
+}
+
+bool StagingBuffer::allocate(VkDeviceSize size, VkDeviceSize alignment, Region& region)
+{
+    alignment = std::max(alignment, m_minAlignment);
+    if (size > m_size)
+        return false;
+
+    releaseCompletedRanges();
+
+    VkDeviceSize offset = 0;
+    while (!findSpace(size, alignment, offset))
+    {
+        // an upload that is still being recorded can't be waited for, a batch that is larger than the ring
+        // makes it grow rather than falling back to a staging buffer per upload
+        const Range& oldest = m_ranges.front();
+        if (oldest.submission == PendingSubmission)
+        {
+            grow();
+            continue;
+        }
+
+        m_device->waitForSubmission(oldest.submission);
+        releaseCompletedRanges();
+    }
+
+    m_ranges.push_back({ offset, offset + size, PendingSubmission });
+    m_head = offset + size;
+
+    region.buffer = m_buffer;
+    region.offset = offset;
+    region.size = size;
+    region.data = m_data + offset;
+
+    return true;
+}
+
+void StagingBuffer::release(const Region& region, uint64_t submission)
+{
+    std::deque<Range>& ranges = getRanges(region.buffer);
+    auto it = std::find_if(ranges.begin(), ranges.end(), [&region](const Range& range) { return range.begin == region.offset; });
+    assert(it != ranges.end() && it->submission == PendingSubmission);
+    it->submission = submission;
+}
+
+void StagingBuffer::flush(const std::vector<Region>& regions)
+{
+    if (regions.empty())
+        return;
+
+    VkBuffer buffer = regions[0].buffer;
+    VkDeviceSize begin = regions[0].offset;
+    VkDeviceSize end = begin;
+    for (const auto& region : regions)
+    {
+        // only alignment padding between the regions, the ring didn't wrap around or grow
+        if (region.buffer != buffer || region.offset < end || region.offset - end >= m_minAlignment)
+        {
+            m_device->flushMemory(getMemory(buffer), begin, end - begin);
+            buffer = region.buffer;
+            begin = region.offset;
+        }
+        end = region.offset + region.size;
+    }
+    m_device->flushMemory(getMemory(buffer), begin, end - begin);
+}
+
+void StagingBuffer::grow()
+{
+    TRACE_ZONE("StagingBuffer::grow");
+
+    // regions of the old buffer are still written and copied from by the batches that allocated them
+    m_retiredBuffers.push_back({ m_buffer, m_memory, std::move(m_ranges) });
+    m_ranges.clear();
+    m_head = 0;
+
+    createBuffer(m_size * 2);
+}
+
+std::deque<StagingBuffer::Range>& StagingBuffer::getRanges(VkBuffer buffer)
+{
+    if (buffer == m_buffer)
+        return m_ranges;
+
+    auto it = std::find_if(m_retiredBuffers.begin(), m_retiredBuffers.end(), [buffer](const RetiredBuffer& retired) { return retired.buffer == buffer; });
+    assert(it != m_retiredBuffers.end());
+    return it->ranges;
+}
+
+const MemoryAllocation& StagingBuffer::getMemory(VkBuffer buffer) const
+{
+    if (buffer == m_buffer)
+        return m_memory;
+
+    auto it = std::find_if(m_retiredBuffers.begin(), m_retiredBuffers.end(), [buffer](const RetiredBuffer& retired) { return retired.buffer == buffer; });
+    assert(it != m_retiredBuffers.end());
+    return it->memory;
+}
+
+bool StagingBuffer::findSpace(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) const
+{
+    if (m_ranges.empty())
+    {
+        offset = 0;
+        return true;
+    }
+
+    const VkDeviceSize tail = m_ranges.front().begin;
+    const VkDeviceSize aligned = alignUp(m_head, alignment);
+
+    // used memory is [tail, head), try behind the head first and wrap around to the start otherwise
+    if (tail < m_head)
+    {
+        if (aligned + size <= m_size)
+        {
+            offset = aligned;
+            return true;
+        }
+        if (size <= tail)
+        {
+            offset = 0;
+            return true;
+        }
+        return false;
+    }
+
+    // the ring already wrapped around, only [head, tail) is free
+    if (aligned + size <= tail)
+    {
+        offset = aligned;
+        return true;
+    }
+    return false;
+}
+
+void StagingBuffer::releaseCompletedRanges()
+{
+    if (releaseCompletedRanges(m_ranges))
+    {
+        m_head = 0;
+    }
+
+    for (auto it = m_retiredBuffers.begin(); it != m_retiredBuffers.end();)
+    {
+        if (releaseCompletedRanges(it->ranges))
+        {
+            m_device->destroyBuffer(it->buffer, it->memory);
+            it = m_retiredBuffers.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+bool StagingBuffer::releaseCompletedRanges(std::deque<Range>& ranges) const
+{
+    while (!ranges.empty())
+    {
+        const Range& oldest = ranges.front();
+        if (oldest.submission == PendingSubmission || !m_device->isSubmissionComplete(oldest.submission))
+            break;
+
+        ranges.pop_front();
+    }
+    return ranges.empty();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "memoryallocator.h"
+
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <vector>
+
+class Device;
+
+// Persistently mapped, host visible ring buffer for uploads. Coherent memory is preferred,
+// otherwise the written regions have to be flushed before the submission that reads them.
+// Every allocated region stays in use until it is released with the submission that reads from it
+// and that submission has completed. When the ring is full it waits for the oldest submission only,
+// if it is full of regions that haven't been submitted yet it grows instead.
+class StagingBuffer
+{
+public:
+    static const VkDeviceSize DefaultSize = 32 * 1024 * 1024;
+
+    struct Region
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        void* data = nullptr;
+    };
+
+    void init(Device* device, VkDeviceSize size = DefaultSize);
+    void destroy();
+
+    // Returns false if the region is larger than the ring
+    bool allocate(VkDeviceSize size, VkDeviceSize alignment, Region& region);
+    // Marks region as read by submission, its memory is reused once the submission completed
+    void release(const Region& region, uint64_t submission);
+    // Makes the host writes to regions visible to the device, regions that follow each other in the ring are flushed together
+    void flush(const std::vector<Region>& regions);
+
+    VkDeviceSize getSize() const { return m_size; }
+
+private:
+    struct Range
+    {
+        VkDeviceSize begin;
+        VkDeviceSize end;
+        uint64_t submission;
+    };
+
+    // a buffer the ring grew out of, destroyed once the submissions reading from it completed
+    struct RetiredBuffer
+    {
+        VkBuffer buffer;
+        MemoryAllocation memory;
+        std::deque<Range> ranges;
+    };
+
+    void createBuffer(VkDeviceSize size);
+    void grow();
+    std::deque<Range>& getRanges(VkBuffer buffer);
+    const MemoryAllocation& getMemory(VkBuffer buffer) const;
+    bool findSpace(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) const;
+    void releaseCompletedRanges();
+    // Removes the completed ranges from the front, returns true if none are left
+    bool releaseCompletedRanges(std::deque<Range>& ranges) const;
+
+    static const uint64_t PendingSubmission = UINT64_MAX;
+
+    Device* m_device = nullptr;
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    MemoryAllocation m_memory;
+    uint8_t* m_data = nullptr;
+    VkDeviceSize m_size = 0;
+    VkDeviceSize m_minAlignment = 1;
+
+    // in use ranges in allocation order, the front one is the oldest
+    std::deque<Range> m_ranges;
+    VkDeviceSize m_head = 0;
+
+    std::vector<RetiredBuffer> m_retiredBuffers;
+};
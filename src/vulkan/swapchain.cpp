@@ -1,17 +1,62 @@
 #include "swapchain.h"
 #include "device.h"
 #include "vulkanhelper.h"
+#include "trace.h"
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 
+const char* toString(PresentPolicy policy)
+{
+    switch (policy)
+    {
+    case PresentPolicy::LowLatency: return "low latency";
+    case PresentPolicy::MaxThroughput: return "max throughput";
+    case PresentPolicy::PowerSaving: return "power saving";
+    }
+    return "unknown";
+}
+
+const char* toString(VkPresentModeKHR presentMode)
+{
+    switch (presentMode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo relaxed";
+    default: return "unknown";
+    }
+}
+
+uint32_t SwapChain::getFramesInFlight(PresentPolicy policy)
+{
+    switch (policy)
+    {
+    case PresentPolicy::LowLatency: return 1;
+    case PresentPolicy::MaxThroughput: return 3;
+    case PresentPolicy::PowerSaving: return 2;
+    }
+    return 2;
+}
+
 void SwapChain::init(VkInstance instance, VkSurfaceKHR surface, Device& device)
 {
     m_instance = instance;
     m_surface = surface;
     m_device = &device;
+}
 
-    createSemaphores();
+void SwapChain::initHeadless(Device& device, uint32_t imageCount, VkFormat format)
+{
+    assert(imageCount > 0);
+
+    m_instance = VK_NULL_HANDLE;
+    m_surface = VK_NULL_HANDLE;
+    m_device = &device;
+    m_offscreenImageCount = imageCount;
+    m_surfaceFormat = { format, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
 }
 
 uint32_t SwapChain::getSwapChainNumImages(VkSurfaceCapabilitiesKHR &surfaceCaps)
@@ -20,6 +65,17 @@ uint32_t SwapChain::getSwapChainNumImages(VkSurfaceCapabilitiesKHR &surfaceCaps)
     // One may be displayed and one may wait in a queue to be presented
     // If application wants to use more images at the same time it must ask for more images
     uint32_t image_count = surfaceCaps.minImageCount + 1;
+    if (m_presentPolicy == PresentPolicy::MaxThroughput)
+    {
+        // one more so the frames in flight never wait for the presentation engine to release an image
+        image_count = surfaceCaps.minImageCount + 2;
+    }
+    else if (m_presentPolicy == PresentPolicy::PowerSaving)
+    {
+        // fifo is limited by the refresh rate anyway, fewer images save memory and queue fewer frames
+        image_count = std::max(surfaceCaps.minImageCount, 2u);
+    }
+
     if ((surfaceCaps.maxImageCount > 0) &&
         (image_count > surfaceCaps.maxImageCount))
     {
@@ -118,30 +174,27 @@ VkSurfaceTransformFlagBitsKHR SwapChain::getSwapChainTransform(VkSurfaceCapabili
     }
 }
 
-VkPresentModeKHR SwapChain::getSwapChainPresentMode(std::vector<VkPresentModeKHR> &presentModes, bool vsync)
+VkPresentModeKHR SwapChain::getSwapChainPresentMode(std::vector<VkPresentModeKHR> &presentModes)
 {
     // FIFO present mode is always available per spec
     // This mode waits for the vertical blank ("v-sync")
-    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (m_presentPolicy == PresentPolicy::PowerSaving)
+        return VK_PRESENT_MODE_FIFO_KHR;
 
-    // If v-sync is not requested, try to find a mailbox mode
-    // It's the lowest latency non-tearing present mode available
-    if (!vsync)
+    // Mailbox is the lowest latency non-tearing present mode, immediate doesn't wait for anything but tears
+    const bool lowLatency = m_presentPolicy == PresentPolicy::LowLatency;
+    const VkPresentModeKHR preferred[2] =
     {
-        for (size_t i = 0; i < presentModes.size(); i++)
-        {
-            if (presentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
-            {
-                swapchainPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-                break;
-            }
-            if ((swapchainPresentMode != VK_PRESENT_MODE_MAILBOX_KHR) && (presentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR))
-            {
-                swapchainPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
-            }
-        }
+        lowLatency ? VK_PRESENT_MODE_MAILBOX_KHR : VK_PRESENT_MODE_IMMEDIATE_KHR,
+        lowLatency ? VK_PRESENT_MODE_IMMEDIATE_KHR : VK_PRESENT_MODE_MAILBOX_KHR
+    };
+
+    for (VkPresentModeKHR presentMode : preferred)
+    {
+        if (std::find(presentModes.begin(), presentModes.end(), presentMode) != presentModes.end())
+            return presentMode;
     }
-    return swapchainPresentMode;
+    return VK_PRESENT_MODE_FIFO_KHR;
 }
 
 VkCompositeAlphaFlagBitsKHR SwapChain::getCompositeAlphaFlags(VkSurfaceCapabilitiesKHR &surfaceCaps)
@@ -167,8 +220,11 @@ VkCompositeAlphaFlagBitsKHR SwapChain::getCompositeAlphaFlags(VkSurfaceCapabilit
     return compositeAlpha;
 }
 
-bool SwapChain::create(uint32_t width, uint32_t height, bool vsync)
+bool SwapChain::create(uint32_t width, uint32_t height)
 {
+    if (isHeadless())
+        return createOffscreenImages(width, height);
+
     VkSwapchainKHR oldSwapchain = m_swapChain;
 
     // Get physical m_device surface properties and formats
@@ -200,7 +256,7 @@ bool SwapChain::create(uint32_t width, uint32_t height, bool vsync)
     uint32_t                      imageCount = getSwapChainNumImages(surfCaps);
     VkImageUsageFlags             usage = getSwapChainUsageFlags(surfCaps);
     VkSurfaceTransformFlagBitsKHR transform = getSwapChainTransform(surfCaps);
-    VkPresentModeKHR              presentMode = getSwapChainPresentMode(presentModes, vsync);
+    VkPresentModeKHR              presentMode = getSwapChainPresentMode(presentModes);
     VkCompositeAlphaFlagBitsKHR   compositeAlpha = getCompositeAlphaFlags(surfCaps);
 
     VkSwapchainCreateInfoKHR swapchainCI = {};
@@ -231,16 +287,12 @@ bool SwapChain::create(uint32_t width, uint32_t height, bool vsync)
         swapchainCI.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
     }
 
-    if (oldSwapchain)
-    {
-        vkDeviceWaitIdle(m_device->getVkDevice());
-    }
-
     VK_CHECK_RESULT(vkCreateSwapchainKHR(m_device->getVkDevice(), &swapchainCI, nullptr, &m_swapChain));
 
-    // If an existing swap chain is re-created, destroy the old swap chain
-    // This also cleans up all the presentable images
-    destroySwapChain(oldSwapchain);
+    // If an existing swap chain is re-created, the old one is retired instead of idling the device.
+    // Frames in flight may still render to its images, so it is destroyed together with its
+    // presentable images once they completed.
+    retireSwapChain(oldSwapchain);
 
     VK_CHECK_RESULT(vkGetSwapchainImagesKHR(m_device->getVkDevice(), m_swapChain, &imageCount, NULL));
 
@@ -249,10 +301,56 @@ bool SwapChain::create(uint32_t width, uint32_t height, bool vsync)
     VK_CHECK_RESULT(vkGetSwapchainImagesKHR(m_device->getVkDevice(), m_swapChain, &imageCount, m_images.data()));
 
     createImageViews(imageCount);
+    m_presentMode = presentMode;
 
     return true;
 }
 
+bool SwapChain::createOffscreenImages(uint32_t width, uint32_t height)
+{
+    destroyOffscreenImages();
+
+    m_extent = { width, height };
+    if (m_extent.width * m_extent.height == 0)
+        return false;
+
+    m_images.resize(m_offscreenImageCount);
+    m_offscreenImageMemory.resize(m_offscreenImageCount);
+    for (uint32_t i = 0; i < m_offscreenImageCount; i++)
+    {
+        // transfer source so the rendered result can be read back or blitted
+        m_device->createImage(width, height,
+            m_surfaceFormat.format,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            m_images[i], m_offscreenImageMemory[i]);
+    }
+    m_nextOffscreenImage = 0;
+
+    createImageViews(m_offscreenImageCount);
+
+    return true;
+}
+
+void SwapChain::destroyOffscreenImages()
+{
+    // frames in flight may still render to the images
+    DeletionQueue& deletionQueue = m_device->getDeletionQueue();
+    for (uint32_t i = 0; i < m_imageViews.size(); i++)
+    {
+        deletionQueue.destroyImageView(m_imageViews[i]);
+    }
+    m_imageViews.clear();
+
+    for (uint32_t i = 0; i < m_images.size(); i++)
+    {
+        deletionQueue.destroyImage(m_images[i], m_offscreenImageMemory[i]);
+    }
+    m_images.clear();
+    m_offscreenImageMemory.clear();
+}
+
 void SwapChain::createImageViews(uint32_t imageCount)
 {
     // Get the swap chain buffers containing the image and imageview
@@ -263,20 +361,21 @@ void SwapChain::createImageViews(uint32_t imageCount)
     }
 }
 
-void SwapChain::createSemaphores()
+bool SwapChain::acquireNextImage(VkSemaphore imageAvailableSemaphore, uint32_t& imageId)
 {
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    TRACE_ZONE("SwapChain::acquireNextImage");
 
-    VK_CHECK_RESULT(vkCreateSemaphore(m_device->getVkDevice(), &semaphoreInfo, nullptr, &m_imageAvailableSemaphore));
-    VK_CHECK_RESULT(vkCreateSemaphore(m_device->getVkDevice(), &semaphoreInfo, nullptr, &m_renderFinishedSemaphore));
-}
+    // Offscreen images are handed out round robin, the caller synchronizes their reuse with fences
+    if (isHeadless())
+    {
+        imageId = m_nextOffscreenImage;
+        m_nextOffscreenImage = (m_nextOffscreenImage + 1) % getImageCount();
+        return true;
+    }
 
-bool SwapChain::acquireNextImage(uint32_t& imageId)
-{
     // By setting timeout to UINT64_MAX we will always wait until the next image has been acquired or an actual error is thrown
     // With that we don't have to handle VK_NOT_READY
-    auto result = vkAcquireNextImageKHR(m_device->getVkDevice(), m_swapChain, UINT64_MAX, m_imageAvailableSemaphore, VK_NULL_HANDLE, &imageId);
+    auto result = vkAcquireNextImageKHR(m_device->getVkDevice(), m_swapChain, UINT64_MAX, imageAvailableSemaphore, VK_NULL_HANDLE, &imageId);
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR)
     {
@@ -290,12 +389,17 @@ bool SwapChain::acquireNextImage(uint32_t& imageId)
     return true;
 }
 
-bool SwapChain::present(uint32_t imageId)
+bool SwapChain::present(uint32_t imageId, VkSemaphore renderFinishedSemaphore)
 {
+    TRACE_ZONE("SwapChain::present");
+
+    if (isHeadless())
+        return true;
+
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &m_renderFinishedSemaphore;
+    presentInfo.pWaitSemaphores = &renderFinishedSemaphore;
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = &m_swapChain;
     presentInfo.pImageIndices = &imageId;
@@ -316,10 +420,25 @@ bool SwapChain::present(uint32_t imageId)
 
 void SwapChain::destroy()
 {
-    destroySwapChain(m_swapChain);
+    if (isHeadless())
+        destroyOffscreenImages();
+    else
+        destroySwapChain(m_swapChain);
+}
+
+void SwapChain::retireSwapChain(VkSwapchainKHR swapChain)
+{
+    if (swapChain == VK_NULL_HANDLE)
+        return;
+
+    DeletionQueue& deletionQueue = m_device->getDeletionQueue();
+    for (uint32_t i = 0; i < m_imageViews.size(); i++)
+    {
+        deletionQueue.destroyImageView(m_imageViews[i]);
+    }
+    m_imageViews.clear();
 
-    vkDestroySemaphore(m_device->getVkDevice(), m_renderFinishedSemaphore, nullptr);
-    vkDestroySemaphore(m_device->getVkDevice(), m_imageAvailableSemaphore, nullptr);
+    deletionQueue.destroySwapChain(swapChain);
 }
 
 void SwapChain::destroySwapChain(VkSwapchainKHR& swapChain)
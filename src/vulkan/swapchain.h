@@ -1,40 +1,72 @@
 #pragma once
 
+#include "memoryallocator.h"
+
 #include <vulkan/vulkan.h>
 #include <vector>
 
 class Device;
 
+// Trade-off between latency, frame rate and power, each maps to a present mode, a swap chain image count
+// and a number of frames in flight
+enum class PresentPolicy
+{
+    // mailbox, falling back to immediate and fifo, one spare image and a single frame in flight
+    LowLatency,
+    // immediate, falling back to mailbox and fifo, two spare images and three frames in flight
+    MaxThroughput,
+    // fifo limited to the refresh rate with as few images as possible and two frames in flight
+    PowerSaving
+};
+
+const char* toString(PresentPolicy policy);
+const char* toString(VkPresentModeKHR presentMode);
+
 class SwapChain
 {
 public:
+    static const uint32_t DefaultOffscreenImageCount = 3;
+    static const PresentPolicy DefaultPresentPolicy = PresentPolicy::PowerSaving;
+
+    static uint32_t getFramesInFlight(PresentPolicy policy);
+
     void init(VkInstance instance, VkSurfaceKHR surface, Device& device);
-    bool create(uint32_t width, uint32_t height, bool vsync = false);
+    // Headless mode: a ring of offscreen images replaces the presentable images of a surface
+    void initHeadless(Device& device, uint32_t imageCount = DefaultOffscreenImageCount, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM);
+    bool create(uint32_t width, uint32_t height);
     void destroy();
 
+    // Takes effect with the next create, offscreen images ignore it
+    void setPresentPolicy(PresentPolicy policy) { m_presentPolicy = policy; }
+    PresentPolicy getPresentPolicy() const { return m_presentPolicy; }
+    // Mode the current swap chain was created with, fifo for offscreen images
+    VkPresentModeKHR getPresentMode() const { return m_presentMode; }
+
+    bool isHeadless() const { return m_surface == VK_NULL_HANDLE; }
     uint32_t getImageCount() const { return static_cast<uint32_t>(m_images.size()); }
+    VkImage getImage(uint32_t imageId) const { return m_images[imageId]; }
     VkExtent2D getImageExtent() const { return m_extent; }
     VkImageView getImageView(uint32_t imageViewId) const { return m_imageViews[imageViewId]; }
     VkFormat getImageFormat() const { return m_surfaceFormat.format; }
 
-    const VkSemaphore* getImageAvailableSemaphore() const { return &m_imageAvailableSemaphore; }
-    const VkSemaphore* getRenderFinishedSemaphore() const { return &m_renderFinishedSemaphore; }
-
-    bool acquireNextImage(uint32_t& imageId);
-    bool present(uint32_t imageId);
+    bool acquireNextImage(VkSemaphore imageAvailableSemaphore, uint32_t& imageId);
+    bool present(uint32_t imageId, VkSemaphore renderFinishedSemaphore);
 
 private:
     void createImageViews(uint32_t imageCount);
-    void createSemaphores();
+    void retireSwapChain(VkSwapchainKHR swapChain);
     void destroySwapChain(VkSwapchainKHR& swapChain);
 
+    bool createOffscreenImages(uint32_t width, uint32_t height);
+    void destroyOffscreenImages();
+
     uint32_t                        getSwapChainNumImages(VkSurfaceCapabilitiesKHR &surfaceCaps);
     VkImageUsageFlags               getSwapChainUsageFlags(VkSurfaceCapabilitiesKHR &surfaceCaps);
     VkSurfaceTransformFlagBitsKHR   getSwapChainTransform(VkSurfaceCapabilitiesKHR &surfaceCaps);
     VkExtent2D                      getSwapChainExtent(VkSurfaceCapabilitiesKHR &surfaceCaps);
     VkCompositeAlphaFlagBitsKHR     getCompositeAlphaFlags(VkSurfaceCapabilitiesKHR &surfaceCaps);
     VkSurfaceFormatKHR              getSwapChainFormat(std::vector<VkSurfaceFormatKHR> &surfaceFormats);
-    VkPresentModeKHR                getSwapChainPresentMode(std::vector<VkPresentModeKHR> &presentModes, bool vsync);
+    VkPresentModeKHR                getSwapChainPresentMode(std::vector<VkPresentModeKHR> &presentModes);
 
     Device* m_device;
 
@@ -43,8 +75,11 @@ private:
     VkSwapchainKHR m_swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> m_images;
     std::vector<VkImageView> m_imageViews;
-    VkSemaphore m_imageAvailableSemaphore = VK_NULL_HANDLE;
-    VkSemaphore m_renderFinishedSemaphore = VK_NULL_HANDLE;
+    std::vector<MemoryAllocation> m_offscreenImageMemory;
+    uint32_t m_offscreenImageCount = 0;
+    uint32_t m_nextOffscreenImage = 0;
     VkExtent2D m_extent = { 0, 0 };
     VkSurfaceFormatKHR m_surfaceFormat = { VK_FORMAT_UNDEFINED, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+    PresentPolicy m_presentPolicy = DefaultPresentPolicy;
+    VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_FIFO_KHR;
 };
\ No newline at end of file
@@ -1,14 +1,71 @@
 #include "texture.h"
 #include "vulkanhelper.h"
 #include "device.h"
+#include "uploadbatch.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-bool Texture::loadFromFile(Device* device, const std::string& filename)
+#include <algorithm>
+#include <vector>
+
+namespace
 {
-    m_device = device;
+    const VkFormat textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+    uint32_t mipLevelCount(uint32_t width, uint32_t height)
+    {
+        uint32_t levels = 1;
+        for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+            ++levels;
+        return levels;
+    }
+
+    // texture.png -> texture_mip1.png
+    std::string mipFilename(const std::string& filename, uint32_t level)
+    {
+        const std::string suffix = "_mip" + std::to_string(level);
+        const size_t dot = filename.find_last_of('.');
+        const size_t slash = filename.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return filename + suffix;
+        return filename.substr(0, dot) + suffix + filename.substr(dot);
+    }
+
+    bool supportsLinearBlit(VkPhysicalDevice physicalDevice, VkFormat format)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
 
+        const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (properties.optimalTilingFeatures & required) == required;
+    }
+
+    // 2x2 box filter of an RGBA8 image, odd rows and columns reuse the last texel
+    void downsample(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, uint32_t dstWidth, uint32_t dstHeight)
+    {
+        for (uint32_t y = 0; y < dstHeight; ++y)
+        {
+            const uint8_t* row0 = src + std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+            const uint8_t* row1 = src + std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+
+            for (uint32_t x = 0; x < dstWidth; ++x)
+            {
+                const uint32_t x0 = std::min(x * 2, srcWidth - 1) * 4;
+                const uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+
+                for (uint32_t c = 0; c < 4; ++c)
+                {
+                    const uint32_t sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                    *dst++ = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+bool Texture::loadFromFile(Device* device, const std::string& filename, UploadBatch* uploadBatch, Mipmaps mipmaps)
+{
     int texWidth, texHeight, texChannels;
     stbi_uc* pixels = stbi_load(filename.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
     if (!pixels)
@@ -17,57 +74,178 @@ bool Texture::loadFromFile(Device* device, const std::string& filename)
         return false;
     }
 
-    const uint32_t imageSize = texWidth * texHeight * 4;
+    if (mipmaps != Mipmaps::Precomputed)
+    {
+        const bool result = createFromPixels(device, pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), uploadBatch, mipmaps);
+        stbi_image_free(pixels);
+        return result;
+    }
+
+    m_device = device;
+
+    const uint32_t width = static_cast<uint32_t>(texWidth);
+    const uint32_t height = static_cast<uint32_t>(texHeight);
+
+    std::vector<MipLevel> levels = { { width, height, pixels } };
+    std::vector<stbi_uc*> loadedImages = { pixels };
+
+    const uint32_t fullChainLevels = mipLevelCount(width, height);
+    for (uint32_t i = 1; i < fullChainLevels; ++i)
+    {
+        const std::string levelFilename = mipFilename(filename, i);
+        stbi_uc* levelPixels = stbi_load(levelFilename.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+        if (!levelPixels)
+            break;
+
+        loadedImages.push_back(levelPixels);
+
+        const uint32_t levelWidth = std::max(width >> i, 1u);
+        const uint32_t levelHeight = std::max(height >> i, 1u);
+        if (static_cast<uint32_t>(texWidth) != levelWidth || static_cast<uint32_t>(texHeight) != levelHeight)
+        {
+            printf("Error: mip level %s is %dx%d but should be %ux%u\n", levelFilename.c_str(), texWidth, texHeight, levelWidth, levelHeight);
+            break;
+        }
+
+        levels.push_back({ levelWidth, levelHeight, levelPixels });
+    }
+
+    create(levels, static_cast<uint32_t>(levels.size()), false, uploadBatch);
+
+    for (auto image : loadedImages)
+    {
+        stbi_image_free(image);
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    device->createBuffer(imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer, stagingBufferMemory);
+    return true;
+}
+
+bool Texture::createFromPixels(Device* device, const uint8_t* pixels, uint32_t width, uint32_t height, UploadBatch* uploadBatch, Mipmaps mipmaps)
+{
+    assert(mipmaps != Mipmaps::Precomputed);
+
+    m_device = device;
 
-    void* data;
-    vkMapMemory(device->getVkDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device->getVkDevice(), stagingBufferMemory);
+    if (mipmaps == Mipmaps::None)
+    {
+        create({ { width, height, pixels } }, 1, false, uploadBatch);
+        return true;
+    }
 
-    stbi_image_free(pixels);
+    const uint32_t fullChainLevels = mipLevelCount(width, height);
+    if (supportsLinearBlit(device->getVkPysicalDevice(), textureFormat))
+    {
+        create({ { width, height, pixels } }, fullChainLevels, true, uploadBatch);
+        return true;
+    }
 
-    device->createImage(texWidth, texHeight,
-        VK_FORMAT_R8G8B8A8_UNORM,
+    std::vector<MipLevel> levels = { { width, height, pixels } };
+    std::vector<std::vector<uint8_t>> generatedImages(fullChainLevels - 1);
+    for (uint32_t i = 1; i < fullChainLevels; ++i)
+    {
+        const MipLevel& previous = levels.back();
+        const uint32_t levelWidth = std::max(previous.width / 2, 1u);
+        const uint32_t levelHeight = std::max(previous.height / 2, 1u);
+
+        std::vector<uint8_t>& levelPixels = generatedImages[i - 1];
+        levelPixels.resize(levelWidth * levelHeight * 4);
+        downsample(previous.pixels, previous.width, previous.height, levelPixels.data(), levelWidth, levelHeight);
+
+        levels.push_back({ levelWidth, levelHeight, levelPixels.data() });
+    }
+
+    create(levels, fullChainLevels, false, uploadBatch);
+    return true;
+}
+
+void Texture::create(const std::vector<MipLevel>& levels, uint32_t mipLevels, bool blitMipmaps, UploadBatch* uploadBatch)
+{
+    m_mipLevels = mipLevels;
+
+    const uint32_t width = levels[0].width;
+    const uint32_t height = levels[0].height;
+
+    UploadBatch localBatch;
+    UploadBatch* batch = uploadBatch;
+    if (!batch)
+    {
+        localBatch.begin(m_device);
+        batch = &localBatch;
+    }
+
+    // all levels that come from the CPU are staged back to back, RGBA8 keeps every offset 4 byte aligned
+    VkDeviceSize stagingSize = 0;
+    for (const auto& level : levels)
+    {
+        stagingSize += level.width * level.height * 4;
+    }
+
+    // optimal tiling can't be written by the CPU, so textures are always staged
+    const StagingBuffer::Region region = batch->stage(stagingSize);
+    m_device->recordUpload("texture", UploadPath::Staged, stagingSize);
+
+    std::vector<VkDeviceSize> offsets;
+    VkDeviceSize offset = 0;
+    for (const auto& level : levels)
+    {
+        const VkDeviceSize levelSize = level.width * level.height * 4;
+        memcpy(static_cast<uint8_t*>(region.data) + offset, level.pixels, static_cast<size_t>(levelSize));
+        offsets.push_back(region.offset + offset);
+        offset += levelSize;
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (blitMipmaps)
+    {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+
+    m_device->createImage(width, height,
+        textureFormat,
         VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        usage,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        m_image, m_imageMemory);
+        m_image, m_imageMemory, m_mipLevels);
 
-    device->transitionImageLayout(m_image,
-        VK_FORMAT_R8G8B8A8_UNORM,
+    batch->transitionImageLayout(m_image,
         VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-    device->copyBufferToImage(stagingBuffer, m_image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-
-    device->transitionImageLayout(m_image,
-        VK_FORMAT_R8G8B8A8_UNORM,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        m_mipLevels);
 
-    vkDestroyBuffer(device->getVkDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(device->getVkDevice(), stagingBufferMemory, nullptr);
+    for (uint32_t i = 0; i < levels.size(); ++i)
+    {
+        batch->copyBufferToImage(region.buffer, m_image, levels[i].width, levels[i].height, offsets[i], i);
+    }
 
-    device->createImageView(m_image, VK_FORMAT_R8G8B8A8_UNORM, m_imageView);
+    if (blitMipmaps)
+    {
+        batch->generateMipmaps(m_image, width, height, m_mipLevels);
+    }
+    else
+    {
+        batch->transitionImageLayout(m_image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            m_mipLevels);
+    }
 
-    return true;
+    if (!uploadBatch)
+    {
+        localBatch.submit();
+        localBatch.wait();
+    }
+
+    m_device->createImageView(m_image, textureFormat, m_imageView, m_mipLevels);
 }
 
 void Texture::destroy()
 {
-    vkDestroyImageView(m_device->getVkDevice(), m_imageView, nullptr);
-    m_imageView = VK_NULL_HANDLE;
+    // frames in flight may still sample the texture
+    DeletionQueue& deletionQueue = m_device->getDeletionQueue();
+    deletionQueue.destroyImageView(m_imageView);
+    deletionQueue.destroyImage(m_image, m_imageMemory);
 
-    vkDestroyImage(m_device->getVkDevice(), m_image, nullptr);
+    m_imageView = VK_NULL_HANDLE;
     m_image = VK_NULL_HANDLE;
-
-    vkFreeMemory(m_device->getVkDevice(), m_imageMemory, nullptr);
-    m_imageMemory = VK_NULL_HANDLE;
+    m_imageMemory = MemoryAllocation();
 }
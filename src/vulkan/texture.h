@@ -1,24 +1,53 @@
 #pragma once
 
+#include "memoryallocator.h"
+
 #include <vulkan/vulkan.h>
 #include <string>
+#include <vector>
 
 class Device;
+class UploadBatch;
 
 class Texture
 {
 public:
-    bool loadFromFile(Device* device, const std::string& filename);
+    enum class Mipmaps
+    {
+        // only the image itself
+        None,
+        // full chain, blitted on the GPU or box filtered on the CPU if the format can't be blitted
+        Generate,
+        // levels are loaded from <name>_mip1.<ext>, <name>_mip2.<ext>, ... next to the file,
+        // the chain ends at the first missing file
+        Precomputed
+    };
+
+    // Without an upload batch the texture is uploaded right away and the call blocks until the copy finished
+    bool loadFromFile(Device* device, const std::string& filename, UploadBatch* uploadBatch = nullptr, Mipmaps mipmaps = Mipmaps::Generate);
+    // pixels are tightly packed RGBA8, they are copied before the call returns. Precomputed mipmaps aren't supported.
+    bool createFromPixels(Device* device, const uint8_t* pixels, uint32_t width, uint32_t height, UploadBatch* uploadBatch = nullptr, Mipmaps mipmaps = Mipmaps::Generate);
     void destroy();
 
     VkImageView getImageView() const { return m_imageView; }
+    uint32_t getMipLevels() const { return m_mipLevels; }
 
 private:
+    struct MipLevel
+    {
+        uint32_t width;
+        uint32_t height;
+        const uint8_t* pixels;
+    };
+
     void createImageView();
+    // levels that aren't given are blitted on the GPU when blitMipmaps is set
+    void create(const std::vector<MipLevel>& levels, uint32_t mipLevels, bool blitMipmaps, UploadBatch* uploadBatch);
 
     Device* m_device = nullptr;
 
     VkImage m_image = VK_NULL_HANDLE;
     VkImageView m_imageView = VK_NULL_HANDLE;
-    VkDeviceMemory m_imageMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_imageMemory;
+    uint32_t m_mipLevels = 1;
 };
@@ -0,0 +1,234 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace
+{
+    namespace detail
+    {
+        std::atomic<bool> recording(false);
+    }
+}
+
+namespace
+{
+    struct Event
+    {
+        const char* name;
+        int64_t begin;
+        int64_t end;
+    };
+
+    // chunks are only ever appended, so writeJson can read them while their thread keeps recording
+    struct Chunk
+    {
+        static const uint32_t Size = 4096;
+
+        Event events[Size];
+        std::atomic<uint32_t> count{ 0 };
+        std::atomic<Chunk*> next{ nullptr };
+    };
+
+    struct ThreadBuffer
+    {
+        ThreadBuffer(uint32_t id, const std::string& name)
+            : id(id)
+            , name(name)
+            , head(new Chunk())
+            , tail(head)
+        {
+        }
+
+        ~ThreadBuffer()
+        {
+            Chunk* chunk = head;
+            while (chunk)
+            {
+                Chunk* next = chunk->next.load(std::memory_order_relaxed);
+                delete chunk;
+                chunk = next;
+            }
+        }
+
+        const uint32_t id;
+        // guarded by s_mutex
+        std::string name;
+        Chunk* const head;
+        // only used by the owning thread
+        Chunk* tail;
+    };
+
+    const uint32_t GpuThreadId = 0;
+
+    std::mutex s_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+    ThreadBuffer* s_gpuBuffer = nullptr;
+
+    bool s_started = false;
+    uint64_t s_firstFrame = 0;
+    uint64_t s_frameCount = 0;
+    uint64_t s_currentFrame = 0;
+
+    thread_local ThreadBuffer* t_buffer = nullptr;
+
+    ThreadBuffer* createBuffer(uint32_t id, const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_buffers.emplace_back(new ThreadBuffer(id, name));
+        return s_buffers.back().get();
+    }
+
+    ThreadBuffer* threadBuffer()
+    {
+        if (!t_buffer)
+        {
+            static std::atomic<uint32_t> nextId(GpuThreadId + 1);
+            const uint32_t id = nextId++;
+            t_buffer = createBuffer(id, "thread " + std::to_string(id));
+        }
+        return t_buffer;
+    }
+
+    void append(ThreadBuffer* buffer, const Event& event)
+    {
+        Chunk* chunk = buffer->tail;
+        uint32_t count = chunk->count.load(std::memory_order_relaxed);
+        if (count == Chunk::Size)
+        {
+            Chunk* next = new Chunk();
+            chunk->next.store(next, std::memory_order_release);
+            buffer->tail = next;
+            chunk = next;
+            count = 0;
+        }
+
+        chunk->events[count] = event;
+        chunk->count.store(count + 1, std::memory_order_release);
+    }
+
+    void updateRecording()
+    {
+        const bool inRange = s_currentFrame >= s_firstFrame && s_currentFrame - s_firstFrame < s_frameCount;
+        trace::detail::recording.store(s_started && inRange, std::memory_order_relaxed);
+    }
+
+    void writeString(std::ostream& out, const std::string& text)
+    {
+        out << '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+}
+
+void trace::start(uint64_t firstFrame, uint64_t frameCount)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_started = true;
+    s_firstFrame = firstFrame;
+    s_frameCount = frameCount;
+    updateRecording();
+}
+
+void trace::stop()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_started = false;
+    updateRecording();
+}
+
+void trace::beginFrame(uint64_t frame)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_currentFrame = frame;
+    updateRecording();
+}
+
+int64_t trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace::addZone(const char* name, int64_t begin, int64_t end)
+{
+    append(threadBuffer(), { name, begin, end });
+}
+
+void trace::addGpuZone(const char* name, int64_t begin, int64_t end)
+{
+    if (!s_gpuBuffer)
+    {
+        s_gpuBuffer = createBuffer(GpuThreadId, "GPU");
+    }
+    append(s_gpuBuffer, { name, begin, end });
+}
+
+void trace::setThreadName(const std::string& name)
+{
+    ThreadBuffer* buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(s_mutex);
+    buffer->name = name;
+}
+
+bool trace::writeJson(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    // timestamps start at the first event, the viewers don't handle the huge steady clock values well
+    int64_t base = std::numeric_limits<int64_t>::max();
+    for (const auto& buffer : s_buffers)
+    {
+        for (const Chunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+        {
+            const uint32_t count = chunk->count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; ++i)
+                base = std::min(base, chunk->events[i].begin);
+        }
+    }
+
+    std::ofstream file(filename);
+    if (!file)
+    {
+        std::cout << "Could not write trace " << filename << std::endl;
+        return false;
+    }
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first = true;
+    for (const auto& buffer : s_buffers)
+    {
+        file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":";
+        writeString(file, buffer->name);
+        file << "}}";
+        first = false;
+
+        for (const Chunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+        {
+            const uint32_t count = chunk->count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const Event& event = chunk->events[i];
+                file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id << ",\"name\":";
+                writeString(file, event.name);
+                file << ",\"ts\":" << (event.begin - base) / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+            }
+        }
+    }
+
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped CPU zones and GPU scopes on one timeline, written as trace event JSON for chrome://tracing or ui.perfetto.dev.
+// Every thread appends to its own buffer without locking, while not recording a zone costs a single relaxed load.
+// Define DISABLE_TRACING to compile TRACE_ZONE out entirely.
+namespace trace
+{
+    namespace detail
+    {
+        extern std::atomic<bool> recording;
+    }
+
+    // Records the frames [firstFrame, firstFrame + frameCount), everything before the first frame counts to frame 0
+    void start(uint64_t firstFrame = 0, uint64_t frameCount = UINT64_MAX);
+    void stop();
+    // Called by the renderer at the beginning of every frame
+    void beginFrame(uint64_t frame);
+
+    inline bool isRecording() { return detail::recording.load(std::memory_order_relaxed); }
+
+    // std::chrono::steady_clock in nanoseconds, the clock of all zones
+    int64_t now();
+
+    // name has to outlive the trace, e.g. a string literal
+    void addZone(const char* name, int64_t begin, int64_t end);
+    // GPU scopes converted to the CPU clock, shown as their own track. Must only be called from one thread.
+    void addGpuZone(const char* name, int64_t begin, int64_t end);
+    void setThreadName(const std::string& name);
+
+    // Writes everything recorded so far
+    bool writeJson(const std::string& filename);
+
+    class Zone
+    {
+    public:
+        explicit Zone(const char* name)
+            : m_name(isRecording() ? name : nullptr)
+            , m_begin(m_name ? now() : 0)
+        {
+        }
+
+        ~Zone()
+        {
+            if (m_name)
+                addZone(m_name, m_begin, now());
+        }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        const char* m_name;
+        int64_t m_begin;
+    };
+}
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifdef DISABLE_TRACING
+#define TRACE_ZONE(name)
+#else
+#define TRACE_ZONE(name) trace::Zone TRACE_CONCAT(traceZone, __LINE__)(name)
+#endif
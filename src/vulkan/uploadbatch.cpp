@@ -0,0 +1,490 @@
+#include "uploadbatch.h"
+#include "vulkanhelper.h"
+#include "device.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void UploadBatch::begin(Device* device)
+{
+    assert(!m_recording && m_submission == 0);
+
+    m_device = device;
+    m_stagedBytes = 0;
+
+    m_commandBuffer = beginCommandBuffer(m_device->getTransferCommandPool());
+    if (m_device->hasDedicatedTransferQueue())
+    {
+        m_graphicsCommandBuffer = beginCommandBuffer(m_device->getCommandPool());
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VK_CHECK_RESULT(vkCreateSemaphore(m_device->getVkDevice(), &semaphoreInfo, nullptr, &m_transferSemaphore));
+    }
+    else
+    {
+        m_graphicsCommandBuffer = m_commandBuffer;
+    }
+
+    m_recording = true;
+}
+
+VkCommandBuffer UploadBatch::beginCommandBuffer(VkCommandPool commandPool)
+{
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(m_device->getVkDevice(), &allocInfo, &commandBuffer));
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+    return commandBuffer;
+}
+
+uint64_t UploadBatch::submit()
+{
+    TRACE_ZONE("UploadBatch::submit");
+
+    assert(m_recording);
+
+    // nothing to do for coherent staging memory
+    m_device->getStagingBuffer().flush(m_stagingRegions);
+    for (const auto& tempBuffer : m_tempBuffers)
+    {
+        m_device->flushMemory(tempBuffer.memory);
+    }
+
+    const VkAccessFlags readAccess = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    const VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+    if (m_device->hasDedicatedTransferQueue())
+    {
+        // exclusive buffers written on the transfer queue have to be handed over to the graphics queue
+        std::vector<VkBufferMemoryBarrier> barriers(m_dstBuffers.size());
+        for (size_t i = 0; i < m_dstBuffers.size(); ++i)
+        {
+            VkBufferMemoryBarrier& barrier = barriers[i];
+            barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.srcQueueFamilyIndex = m_device->getTransferQueueFamilyIndex();
+            barrier.dstQueueFamilyIndex = m_device->getGraphicsQueueFamilyIndex();
+            barrier.buffer = m_dstBuffers[i];
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+        }
+
+        if (!barriers.empty())
+        {
+            // release
+            vkCmdPipelineBarrier(
+                m_commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                0,
+                0, nullptr,
+                static_cast<uint32_t>(barriers.size()), barriers.data(),
+                0, nullptr
+            );
+
+            // acquire
+            for (auto& barrier : barriers)
+            {
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = readAccess;
+            }
+            vkCmdPipelineBarrier(
+                m_graphicsCommandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, readStages,
+                0,
+                0, nullptr,
+                static_cast<uint32_t>(barriers.size()), barriers.data(),
+                0, nullptr
+            );
+        }
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(m_commandBuffer));
+        VK_CHECK_RESULT(vkEndCommandBuffer(m_graphicsCommandBuffer));
+        m_recording = false;
+
+        // the copies don't need a fence of their own, the graphics submission waits for them
+        VkSubmitInfo transferSubmitInfo = {};
+        transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        transferSubmitInfo.commandBufferCount = 1;
+        transferSubmitInfo.pCommandBuffers = &m_commandBuffer;
+        transferSubmitInfo.signalSemaphoreCount = 1;
+        transferSubmitInfo.pSignalSemaphores = &m_transferSemaphore;
+
+        VK_CHECK_RESULT(vkQueueSubmit(m_device->getTransferQueue(), 1, &transferSubmitInfo, VK_NULL_HANDLE));
+
+        // the acquire barriers wait in the transfer stage, which is also where mip blits run
+        const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &m_transferSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &m_graphicsCommandBuffer;
+
+        m_submission = m_device->submit(m_device->getGraphicsQueue(), submitInfo);
+    }
+    else
+    {
+        // make the copied buffer data visible to the rendering that follows in later submissions
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = readAccess;
+        vkCmdPipelineBarrier(
+            m_commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, readStages,
+            0,
+            1, &barrier,
+            0, nullptr,
+            0, nullptr
+        );
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(m_commandBuffer));
+        m_recording = false;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &m_commandBuffer;
+
+        m_submission = m_device->submit(m_device->getGraphicsQueue(), submitInfo);
+    }
+
+    m_dstBuffers.clear();
+
+    // the staging ring can reuse the memory as soon as this submission completed
+    for (const auto& region : m_stagingRegions)
+    {
+        m_device->getStagingBuffer().release(region, m_submission);
+    }
+    m_stagingRegions.clear();
+
+    return m_submission;
+}
+
+bool UploadBatch::isComplete()
+{
+    if (m_submission == 0)
+        return !m_recording;
+
+    if (!m_device->isSubmissionComplete(m_submission))
+        return false;
+
+    release();
+    return true;
+}
+
+void UploadBatch::wait()
+{
+    TRACE_ZONE("UploadBatch::wait");
+
+    if (m_submission == 0)
+        return;
+
+    m_device->waitForSubmission(m_submission);
+    release();
+}
+
+void UploadBatch::release()
+{
+    vkFreeCommandBuffers(m_device->getVkDevice(), m_device->getTransferCommandPool(), 1, &m_commandBuffer);
+    if (m_graphicsCommandBuffer != m_commandBuffer)
+    {
+        vkFreeCommandBuffers(m_device->getVkDevice(), m_device->getCommandPool(), 1, &m_graphicsCommandBuffer);
+    }
+    m_commandBuffer = VK_NULL_HANDLE;
+    m_graphicsCommandBuffer = VK_NULL_HANDLE;
+
+    if (m_transferSemaphore != VK_NULL_HANDLE)
+    {
+        vkDestroySemaphore(m_device->getVkDevice(), m_transferSemaphore, nullptr);
+        m_transferSemaphore = VK_NULL_HANDLE;
+    }
+
+    for (auto& tempBuffer : m_tempBuffers)
+    {
+        m_device->destroyBuffer(tempBuffer.buffer, tempBuffer.memory);
+    }
+    m_tempBuffers.clear();
+
+    m_submission = 0;
+}
+
+void* UploadBatch::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+    const StagingBuffer::Region region = stage(size);
+    copyBuffer(region.buffer, dstBuffer, size, region.offset, dstOffset);
+    return region.data;
+}
+
+StagingBuffer::Region UploadBatch::stage(VkDeviceSize size, VkDeviceSize alignment)
+{
+    TRACE_ZONE("UploadBatch::stage");
+
+    assert(m_recording);
+
+    m_stagedBytes += size;
+
+    StagingBuffer::Region region;
+    if (m_device->getStagingBuffer().allocate(size, alignment, region))
+    {
+        m_stagingRegions.push_back(region);
+        return region;
+    }
+
+    // larger than the whole staging ring, use a temporary staging buffer that lives as long as the batch
+    TempBuffer tempBuffer;
+    m_device->createBuffer(static_cast<uint32_t>(size),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        tempBuffer.buffer, tempBuffer.memory,
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_tempBuffers.push_back(tempBuffer);
+
+    region.buffer = tempBuffer.buffer;
+    region.offset = 0;
+    region.size = size;
+    region.data = tempBuffer.memory.mappedData;
+
+    return region;
+}
+
+void UploadBatch::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+{
+    assert(m_recording);
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(m_commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+    if (std::find(m_dstBuffers.begin(), m_dstBuffers.end(), dstBuffer) == m_dstBuffers.end())
+    {
+        m_dstBuffers.push_back(dstBuffer);
+    }
+}
+
+void UploadBatch::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkDeviceSize bufferOffset, uint32_t mipLevel)
+{
+    assert(m_recording);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = bufferOffset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mipLevel;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = { width, height, 1 };
+
+    vkCmdCopyBufferToImage(m_commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+void UploadBatch::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+{
+    assert(m_recording);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    VkPipelineStageFlags sourceStage;
+    VkPipelineStageFlags destinationStage;
+
+    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+        if (m_device->hasDedicatedTransferQueue())
+        {
+            // the layout transition is part of the ownership transfer to the graphics queue,
+            // both the release and the acquire barrier have to specify it
+            barrier.srcQueueFamilyIndex = m_device->getTransferQueueFamilyIndex();
+            barrier.dstQueueFamilyIndex = m_device->getGraphicsQueueFamilyIndex();
+            barrier.dstAccessMask = 0;
+
+            vkCmdPipelineBarrier(
+                m_commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &barrier
+            );
+
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            vkCmdPipelineBarrier(
+                m_graphicsCommandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, destinationStage,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &barrier
+            );
+            return;
+        }
+    }
+    else
+    {
+        throw std::invalid_argument("unsupported layout transition!");
+    }
+
+    vkCmdPipelineBarrier(
+        m_commandBuffer,
+        sourceStage, destinationStage,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier
+    );
+}
+
+void UploadBatch::generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+    TRACE_ZONE("UploadBatch::generateMipmaps");
+
+    assert(m_recording);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    if (m_device->hasDedicatedTransferQueue())
+    {
+        // blits need a graphics queue, hand the whole chain over in the layout the copies left it in
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = m_device->getTransferQueueFamilyIndex();
+        barrier.dstQueueFamilyIndex = m_device->getGraphicsQueueFamilyIndex();
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(m_commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(m_graphicsCommandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    barrier.subresourceRange.levelCount = 1;
+
+    int32_t mipWidth = static_cast<int32_t>(width);
+    int32_t mipHeight = static_cast<int32_t>(height);
+
+    for (uint32_t i = 1; i < mipLevels; ++i)
+    {
+        // the previous level is complete, read from it
+        barrier.subresourceRange.baseMipLevel = i - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(m_graphicsCommandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        const int32_t nextWidth = mipWidth > 1 ? mipWidth / 2 : 1;
+        const int32_t nextHeight = mipHeight > 1 ? mipHeight / 2 : 1;
+
+        VkImageBlit blit = {};
+        blit.srcOffsets[0] = { 0, 0, 0 };
+        blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = i - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[0] = { 0, 0, 0 };
+        blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = i;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+
+        vkCmdBlitImage(m_graphicsCommandBuffer,
+            image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, VK_FILTER_LINEAR);
+
+        // the previous level is final
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(m_graphicsCommandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        mipWidth = nextWidth;
+        mipHeight = nextHeight;
+    }
+
+    // the last level was only written
+    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(m_graphicsCommandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "stagingbuffer.h"
+#include "memoryallocator.h"
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+class Device;
+
+// Records any number of copies and layout transitions into one command buffer
+// which is submitted once with a fence. Completion can be waited for or polled.
+// With a dedicated transfer queue family the copies run on the transfer queue and the written
+// resources are handed over to the graphics queue, which waits for the copies with a semaphore.
+class UploadBatch
+{
+public:
+    void begin(Device* device);
+    uint64_t submit();
+
+    // Both free the resources of the batch once it completed, afterwards it can begin again
+    bool isComplete();
+    void wait();
+
+    // Returns memory for size bytes that are copied to dstBuffer when the batch executes,
+    // it has to be written before the batch is submitted
+    void* uploadBuffer(VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+    // Staging memory that lives until the batch completed
+    StagingBuffer::Region stage(VkDeviceSize size, VkDeviceSize alignment = 4);
+
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkDeviceSize bufferOffset = 0, uint32_t mipLevel = 0);
+    // Transitions the first mipLevels levels of image
+    void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+    // Fills levels 1 to mipLevels - 1 by successively blitting from the previous level on the graphics queue.
+    // All levels have to be in TRANSFER_DST_OPTIMAL with level 0 written, afterwards they are SHADER_READ_ONLY_OPTIMAL.
+    // The format has to support linear filtered blits.
+    void generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+    // Records on the transfer queue
+    VkCommandBuffer getCommandBuffer() const { return m_commandBuffer; }
+    // Records on the graphics queue after all copies and ownership transfers of the batch
+    VkCommandBuffer getGraphicsCommandBuffer() const { return m_graphicsCommandBuffer; }
+    bool isRecording() const { return m_recording; }
+    // Bytes staged since begin
+    VkDeviceSize getStagedBytes() const { return m_stagedBytes; }
+
+private:
+    struct TempBuffer
+    {
+        VkBuffer buffer;
+        MemoryAllocation memory;
+    };
+
+    VkCommandBuffer beginCommandBuffer(VkCommandPool commandPool);
+    void release();
+
+    Device* m_device = nullptr;
+    VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
+    VkCommandBuffer m_graphicsCommandBuffer = VK_NULL_HANDLE;
+    VkSemaphore m_transferSemaphore = VK_NULL_HANDLE;
+    bool m_recording = false;
+    uint64_t m_submission = 0;
+    VkDeviceSize m_stagedBytes = 0;
+
+    // buffers that have to change queue family ownership when the batch is submitted
+    std::vector<VkBuffer> m_dstBuffers;
+    std::vector<StagingBuffer::Region> m_stagingRegions;
+    // staging memory for uploads that are larger than the whole staging ring
+    std::vector<TempBuffer> m_tempBuffers;
+};
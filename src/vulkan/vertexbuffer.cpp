@@ -1,48 +1,148 @@
 #include "vertexbuffer.h"
 #include "vulkanhelper.h"
 #include "device.h"
+#include "uploadbatch.h"
 
-const static bool useStaging = true;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VERTEXBUFFER_SSE2
+#endif
+
+#include <algorithm>
 
 namespace
 {
-    VkFormat getAttributeFormat(uint32_t numVertices)
+    // One attribute of an interleaved vertex, converted to its format and padded to whole 32 bit words
+    struct Stream
+    {
+        const uint32_t* data;
+        uint32_t wordCount;
+    };
+
+    // Copies four vertices of one attribute into a block of four interleaved vertices with stride words each
+    void transposeAttribute(const uint32_t* src, uint32_t wordCount, uint32_t* block, uint32_t stride)
+    {
+#ifdef VERTEXBUFFER_SSE2
+        if (wordCount == 2)
+        {
+            const __m128i v01 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            const __m128i v23 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(block), v01);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(block + stride), _mm_srli_si128(v01, 8));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(block + stride * 2), v23);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(block + stride * 3), _mm_srli_si128(v23, 8));
+            return;
+        }
+        if (wordCount == 4)
+        {
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(block + stride * i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4)));
+            }
+            return;
+        }
+#endif
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            for (uint32_t c = 0; c < wordCount; ++c)
+            {
+                block[stride * i + c] = src[i * wordCount + c];
+            }
+        }
+    }
+
+    // Interleaves the streams into dst with stride words per vertex. Groups of four vertices are
+    // transposed in a block that stays in the L1 cache and written out with full 16 byte stores, because dst
+    // usually is write combined memory where scattered partial writes are slow.
+    void interleave(const std::vector<Stream>& streams, uint32_t vertexCount, uint32_t stride, uint32_t* dst)
     {
-        switch (numVertices)
+        const uint32_t blockVertexCount = vertexCount & ~3u;
+
+        std::vector<uint32_t> block(stride * 4);
+        for (uint32_t vertex = 0; vertex < blockVertexCount; vertex += 4)
+        {
+            uint32_t offset = 0;
+            for (const auto& stream : streams)
+            {
+                transposeAttribute(stream.data + vertex * stream.wordCount, stream.wordCount, block.data() + offset, stride);
+                offset += stream.wordCount;
+            }
+
+            // four vertices are always a multiple of four words
+            uint32_t* out = dst + vertex * stride;
+#ifdef VERTEXBUFFER_SSE2
+            for (uint32_t i = 0; i < stride * 4; i += 4)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(block.data() + i)));
+            }
+#else
+            memcpy(out, block.data(), stride * 4 * sizeof(uint32_t));
+#endif
+        }
+
+        for (uint32_t vertex = blockVertexCount; vertex < vertexCount; ++vertex)
         {
-        case 1: return VK_FORMAT_R32_SFLOAT;
-        case 2: return VK_FORMAT_R32G32_SFLOAT;
-        case 3: return VK_FORMAT_R32G32B32_SFLOAT;
-        default:
-            assert(!"Unknown number of vertices");
-            return VK_FORMAT_UNDEFINED;
+            uint32_t* out = dst + vertex * stride;
+            for (const auto& stream : streams)
+            {
+                memcpy(out, stream.data + vertex * stream.wordCount, stream.wordCount * sizeof(uint32_t));
+                out += stream.wordCount;
+            }
         }
     }
+
+    // Writes the attribute in format, vertices dstStride bytes apart
+    void writeAttribute(const VertexBuffer::AttributeDescription& desc, VkFormat format, void* dst, uint32_t dstStride)
+    {
+        if (desc.sourceType == vertexformat::SourceType::Float32)
+            vertexformat::convert(static_cast<const float*>(desc.vertexData), desc.componentCount, desc.vertexCount, format, dst, dstStride);
+        else
+            vertexformat::copy(desc.vertexData, desc.sourceType, desc.componentCount, desc.vertexCount, format, dst, dstStride);
+    }
 }
 
-void VertexBuffer::init(Device* device, const std::vector<AttributeDescription>& descriptions)
+void VertexBuffer::init(Device* device, const std::vector<AttributeDescription>& descriptions, UploadBatch* uploadBatch, Layout layout)
 {
     if (descriptions.size() == 0)
         return;
 
     m_device = device;
     m_numVertices = descriptions[0].vertexCount;
+    m_layout = layout;
+
+    std::vector<VkFormat> formats(descriptions.size());
+    for (size_t i = 0; i < descriptions.size(); i++)
+    {
+        assert(m_numVertices == descriptions[i].vertexCount);
+        formats[i] = resolveFormat(descriptions[i]);
+    }
+
+    if (layout == Layout::Interleaved)
+    {
+        initInterleaved(descriptions, formats, uploadBatch);
+        return;
+    }
 
-    auto totalSize = 0;
+    uint32_t totalSize = 0;
+    m_vertexSize = 0;
     m_attributesDescriptions.resize(descriptions.size());
     m_bindingDescriptions.resize(descriptions.size());
+    m_bindingOffsets.resize(descriptions.size());
     for (auto i = 0; i < descriptions.size(); i++)
     {
         const auto& desc = descriptions[i];
-        assert(m_numVertices == desc.vertexCount);
+        const auto attributeSize = vertexformat::getFormatInfo(formats[i]).size;
 
         VkVertexInputAttributeDescription& attribDesc = m_attributesDescriptions[i];
         attribDesc.binding = i;
         attribDesc.location = desc.location;
-        attribDesc.format = getAttributeFormat(desc.componentCount);
-        attribDesc.offset = totalSize;
+        attribDesc.format = formats[i];
+        // the binding offset points at the attribute, an attribute offset would be limited to maxVertexInputAttributeOffset
+        attribDesc.offset = 0;
 
-        const auto attributeSize = desc.componentCount * 4;
+        // arrays of 16 and 8 bit formats start on 4 bytes so every binding offset stays aligned
+        totalSize = (totalSize + 3) & ~3u;
+        m_bindingOffsets[i] = totalSize;
 
         VkVertexInputBindingDescription& bindingDesc = m_bindingDescriptions[i];
         bindingDesc.binding = i;
@@ -50,77 +150,155 @@ void VertexBuffer::init(Device* device, const std::vector<AttributeDescription>&
         bindingDesc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
         totalSize += desc.vertexCount * attributeSize;
+        m_vertexSize += attributeSize;
     }
 
     auto memcpyFunc = [&](void *mappedMemory)
     {
-        auto data = reinterpret_cast<float*>(mappedMemory);
-        for (auto& desc : descriptions)
+        auto data = static_cast<uint8_t*>(mappedMemory);
+        for (size_t i = 0; i < descriptions.size(); i++)
         {
-            const auto attributeSize = desc.componentCount * desc.vertexCount;
-            memcpy(data, desc.vertexData, attributeSize * 4);
-            data += attributeSize;
+            writeAttribute(descriptions[i], formats[i], data + m_bindingOffsets[i], m_bindingDescriptions[i].stride);
         }
     };
 
-    createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, totalSize, m_vertexBuffer, m_vertexBufferMemory, memcpyFunc);
+    createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, totalSize, m_vertexBuffer, m_vertexBufferMemory, memcpyFunc, uploadBatch, "vertex buffer");
 }
 
-void VertexBuffer::createBuffer(VkBufferUsageFlags usage, uint32_t size, VkBuffer& buffer, VkDeviceMemory& bufferMemory, const MemcpyFunc& memcpyFunc)
+void VertexBuffer::initInterleaved(const std::vector<AttributeDescription>& descriptions, const std::vector<VkFormat>& formats, UploadBatch* uploadBatch)
 {
-    if (useStaging)
+    m_attributesDescriptions.resize(descriptions.size());
+    m_bindingDescriptions.resize(1);
+    m_bindingOffsets.assign(1, 0);
+
+    // attributes are padded to whole words, which keeps them aligned for formats with 4 byte components
+    // and lets the interleaving move words instead of bytes
+    std::vector<Stream> streams(descriptions.size());
+    std::vector<std::vector<uint32_t>> converted(descriptions.size());
+    uint32_t stride = 0;
+    for (size_t i = 0; i < descriptions.size(); i++)
     {
-        // TODO: use single persistent staging buffer?
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
+        const auto& desc = descriptions[i];
+        const auto wordCount = (vertexformat::getFormatInfo(formats[i]).size + 3) / 4;
+
+        VkVertexInputAttributeDescription& attribDesc = m_attributesDescriptions[i];
+        attribDesc.binding = 0;
+        attribDesc.location = desc.location;
+        attribDesc.format = formats[i];
+        attribDesc.offset = stride * 4;
+
+        if (desc.sourceType == vertexformat::SourceType::Float32 && formats[i] == vertexformat::getFloatFormat(desc.componentCount))
+        {
+            // already in place
+            streams[i] = { static_cast<const uint32_t*>(desc.vertexData), wordCount };
+        }
+        else
+        {
+            converted[i].resize(desc.vertexCount * wordCount);
+            writeAttribute(desc, formats[i], converted[i].data(), wordCount * 4);
+            streams[i] = { converted[i].data(), wordCount };
+        }
 
-        m_device->createBuffer(size,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            stagingBuffer, stagingBufferMemory);
+        stride += wordCount;
+    }
+    m_vertexSize = stride * 4;
 
-        mapMemory(stagingBufferMemory, memcpyFunc);
+    VkVertexInputBindingDescription& bindingDesc = m_bindingDescriptions[0];
+    bindingDesc.binding = 0;
+    bindingDesc.stride = stride * 4;
+    bindingDesc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-        m_device->createBuffer(size,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            buffer, bufferMemory);
+    auto memcpyFunc = [&](void *mappedMemory)
+    {
+        interleave(streams, m_numVertices, stride, static_cast<uint32_t*>(mappedMemory));
+    };
 
-        m_device->copyBuffer(stagingBuffer, buffer, size);
+    createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_numVertices * stride * 4, m_vertexBuffer, m_vertexBufferMemory, memcpyFunc, uploadBatch, "vertex buffer");
+}
 
-        vkDestroyBuffer(m_device->getVkDevice(), stagingBuffer, nullptr);
-        vkFreeMemory(m_device->getVkDevice(), stagingBufferMemory, nullptr);
-    }
-    else
+VkFormat VertexBuffer::resolveFormat(const AttributeDescription& desc) const
+{
+    const VkFormat floatFormat = vertexformat::getFloatFormat(desc.componentCount);
+    if (desc.format == VK_FORMAT_UNDEFINED)
     {
-        m_device->createBuffer(size,
-            usage,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            buffer, bufferMemory);
+        assert(desc.sourceType == vertexformat::SourceType::Float32);
+        return floatFormat;
+    }
+
+    assert(vertexformat::getFormatInfo(desc.format).encoding != vertexformat::Encoding::Unknown);
+    assert(desc.componentCount <= vertexformat::getFormatInfo(desc.format).componentCount);
+
+    // three component 8 and 16 bit formats and the packed SNORM format are optional for vertex buffers
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(m_device->getVkPysicalDevice(), desc.format, &properties);
+    if (properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT)
+        return desc.format;
 
-        mapMemory(bufferMemory, memcpyFunc);
+    if (desc.sourceType == vertexformat::SourceType::Float32)
+    {
+        std::cout << "Warning: vertex format " << desc.format << " is not supported, attribute " << desc.location << " falls back to 32 bit floats" << std::endl;
+        return floatFormat;
     }
+
+    assert(!"Vertex format not supported and the data can't be converted");
+    return desc.format;
 }
 
-void VertexBuffer::mapMemory(VkDeviceMemory bufferMemory, const MemcpyFunc& memcpyFunc)
+void VertexBuffer::createBuffer(VkBufferUsageFlags usage, uint32_t size, VkBuffer& buffer, MemoryAllocation& bufferMemory, const MemcpyFunc& memcpyFunc, UploadBatch* uploadBatch, const char* resource)
 {
-    void* mappedMemory;
-    VK_CHECK_RESULT(vkMapMemory(m_device->getVkDevice(), bufferMemory, 0, VK_WHOLE_SIZE, 0, &mappedMemory));
-    memcpyFunc(mappedMemory);
-    vkUnmapMemory(m_device->getVkDevice(), bufferMemory);
+    // device local memory the CPU can write is preferred as long as its heap has room,
+    // integrated GPUs and resizable BAR expose it. Anything else is copied from staging memory.
+    const bool allowDirect = m_device->getDirectUploads();
+
+    m_device->createBuffer(size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        buffer, bufferMemory,
+        allowDirect ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT : 0);
+
+    if (allowDirect && (m_device->getMemoryFlags(bufferMemory) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+    {
+        // the buffer is new, so no frame can be reading it while it is written
+        memcpyFunc(bufferMemory.mappedData);
+        m_device->flushMemory(bufferMemory, 0, size);
+        m_device->recordUpload(resource, UploadPath::Direct, size);
+        return;
+    }
+
+    if (uploadBatch)
+    {
+        memcpyFunc(uploadBatch->uploadBuffer(buffer, size));
+    }
+    else
+    {
+        UploadBatch batch;
+        batch.begin(m_device);
+        memcpyFunc(batch.uploadBuffer(buffer, size));
+        batch.submit();
+        batch.wait();
+    }
+    m_device->recordUpload(resource, UploadPath::Staged, size);
 }
 
-void VertexBuffer::setIndices(const uint16_t *indices, uint32_t numIndices)
+void VertexBuffer::setIndices(const uint16_t *indices, uint32_t numIndices, UploadBatch* uploadBatch)
 {
-     createIndexBuffer(indices, numIndices, VK_INDEX_TYPE_UINT16);
+     createIndexBuffer(indices, numIndices, VK_INDEX_TYPE_UINT16, uploadBatch);
 }
 
-void VertexBuffer::setIndices(const uint32_t *indices, uint32_t numIndices)
+void VertexBuffer::setIndices(const uint32_t *indices, uint32_t numIndices, UploadBatch* uploadBatch)
 {
-     createIndexBuffer(indices, numIndices, VK_INDEX_TYPE_UINT32);
+    // 16 bit indices halve the index buffer and the bandwidth the input assembler reads
+    if (numIndices > 0 && *std::max_element(indices, indices + numIndices) <= 0xFFFF)
+    {
+        const std::vector<uint16_t> narrowIndices(indices, indices + numIndices);
+        createIndexBuffer(narrowIndices.data(), numIndices, VK_INDEX_TYPE_UINT16, uploadBatch);
+        return;
+    }
+
+    createIndexBuffer(indices, numIndices, VK_INDEX_TYPE_UINT32, uploadBatch);
 }
 
-void VertexBuffer::createIndexBuffer(const void *indices, uint32_t numIndices, VkIndexType indexType)
+void VertexBuffer::createIndexBuffer(const void *indices, uint32_t numIndices, VkIndexType indexType, UploadBatch* uploadBatch)
 {
     m_numIndices = numIndices;
     m_indexType = indexType;
@@ -131,26 +309,89 @@ void VertexBuffer::createIndexBuffer(const void *indices, uint32_t numIndices, V
         memcpy(mappedMemory, indices, size);
     };
 
-    createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, size, m_indexBuffer, m_indexBufferMemory, memcpyFunc);
+    createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, size, m_indexBuffer, m_indexBufferMemory, memcpyFunc, uploadBatch, "index buffer");
+}
+
+void VertexBuffer::setInstanceLayout(uint32_t stride, const std::vector<InstanceAttributeDescription>& attributes)
+{
+    assert(m_device != nullptr);
+    assert(m_instanceBinding == NoInstanceBinding);
+
+    m_instanceBinding = static_cast<uint32_t>(m_bindingDescriptions.size());
+
+    VkVertexInputBindingDescription bindingDesc = {};
+    bindingDesc.binding = m_instanceBinding;
+    bindingDesc.stride = stride;
+    bindingDesc.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    m_bindingDescriptions.push_back(bindingDesc);
+
+    for (const auto& attribute : attributes)
+    {
+        assert(attribute.offset + vertexformat::getFormatInfo(attribute.format).size <= stride);
+
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(m_device->getVkPysicalDevice(), attribute.format, &properties);
+        assert(properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT);
+
+        VkVertexInputAttributeDescription attribDesc = {};
+        attribDesc.binding = m_instanceBinding;
+        attribDesc.location = attribute.location;
+        attribDesc.format = attribute.format;
+        attribDesc.offset = attribute.offset;
+        m_attributesDescriptions.push_back(attribDesc);
+    }
+}
+
+void VertexBuffer::setInstances(const void* instances, uint32_t instanceCount, UploadBatch* uploadBatch)
+{
+    assert(m_instanceBinding != NoInstanceBinding);
+    assert(m_instanceBuffer == VK_NULL_HANDLE);
+
+    m_numInstances = instanceCount;
+    const uint32_t size = instanceCount * m_bindingDescriptions[m_instanceBinding].stride;
+
+    auto memcpyFunc = [=](void *mappedMemory) {
+        memcpy(mappedMemory, instances, size);
+    };
+
+    createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, size, m_instanceBuffer, m_instanceBufferMemory, memcpyFunc, uploadBatch, "instance buffer");
+}
+
+void VertexBuffer::bindInstances(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset) const
+{
+    assert(m_instanceBinding != NoInstanceBinding);
+    vkCmdBindVertexBuffers(commandBuffer, m_instanceBinding, 1, &buffer, &offset);
 }
 
-void VertexBuffer::draw(VkCommandBuffer commandBuffer) const
+void VertexBuffer::bind(VkCommandBuffer commandBuffer) const
 {
-    const VkDeviceSize offset = 0;
+    for (uint32_t i = 0; i < m_bindingOffsets.size(); i++)
+    {
+        vkCmdBindVertexBuffers(commandBuffer, i, 1, &m_vertexBuffer, &m_bindingOffsets[i]);
+    }
 
-    for (auto i = 0; i < m_bindingDescriptions.size(); i++)
+    if (m_instanceBuffer != VK_NULL_HANDLE)
     {
-        vkCmdBindVertexBuffers(commandBuffer, i, 1, &m_vertexBuffer, &offset);
+        bindInstances(commandBuffer, m_instanceBuffer, 0);
     }
 
     if (m_indexBuffer != VK_NULL_HANDLE)
     {
         vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, m_indexType);
-        vkCmdDrawIndexed(commandBuffer, m_numIndices, 1, 0, 0, 0);
+    }
+}
+
+void VertexBuffer::draw(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint32_t firstInstance) const
+{
+    bind(commandBuffer);
+
+    if (m_indexBuffer != VK_NULL_HANDLE)
+    {
+        vkCmdDrawIndexed(commandBuffer, m_numIndices, instanceCount, 0, 0, firstInstance);
     }
     else
     {
-        vkCmdDraw(commandBuffer, m_numVertices, 1, 0, 0);
+        vkCmdDraw(commandBuffer, m_numVertices, instanceCount, 0, firstInstance);
     }
 }
 
@@ -166,16 +407,25 @@ const std::vector<VkVertexInputBindingDescription>& VertexBuffer::getBindingDesc
 
 void VertexBuffer::destroy()
 {
-    vkDestroyBuffer(m_device->getVkDevice(), m_vertexBuffer, nullptr);
+    // frames in flight may still read the buffers
+    DeletionQueue& deletionQueue = m_device->getDeletionQueue();
+    deletionQueue.destroyBuffer(m_vertexBuffer, m_vertexBufferMemory);
     m_vertexBuffer = VK_NULL_HANDLE;
-    vkFreeMemory(m_device->getVkDevice(), m_vertexBufferMemory, nullptr);
-    m_vertexBufferMemory = VK_NULL_HANDLE;
+    m_vertexBufferMemory = MemoryAllocation();
 
     if (m_indexBuffer != VK_NULL_HANDLE)
     {
-        vkDestroyBuffer(m_device->getVkDevice(), m_indexBuffer, nullptr);
+        deletionQueue.destroyBuffer(m_indexBuffer, m_indexBufferMemory);
         m_indexBuffer = VK_NULL_HANDLE;
-        vkFreeMemory(m_device->getVkDevice(), m_indexBufferMemory, nullptr);
-        m_indexBufferMemory = VK_NULL_HANDLE;
+        m_indexBufferMemory = MemoryAllocation();
+    }
+
+    if (m_instanceBuffer != VK_NULL_HANDLE)
+    {
+        deletionQueue.destroyBuffer(m_instanceBuffer, m_instanceBufferMemory);
+        m_instanceBuffer = VK_NULL_HANDLE;
+        m_instanceBufferMemory = MemoryAllocation();
     }
+    m_instanceBinding = NoInstanceBinding;
+    m_numInstances = 0;
 }
@@ -1,17 +1,31 @@
 #pragma once
 
+#include "memoryallocator.h"
+#include "vertexformat.h"
+
 #include <vulkan/vulkan.h>
 #include <vector>
 #include <functional>
 
 class Device;
+class UploadBatch;
 
 
 class VertexBuffer
 {
 public:
+    enum class Layout
+    {
+        // every attribute is a tightly packed array with a binding of its own
+        Planar,
+        // all attributes of a vertex are next to each other in one binding, fewer bindings and better
+        // locality when vertices are fetched out of order
+        Interleaved
+    };
+
     struct AttributeDescription
     {
+        // 32 bit floats
         AttributeDescription(uint32_t _location, uint32_t _componentCount, uint32_t _vertexCount, const float* _vertexData)
             : location(_location)
             , componentCount(_componentCount)
@@ -19,39 +33,104 @@ public:
             , vertexData(_vertexData)
         {}
 
+        // floats converted to a compact format, e.g. VK_FORMAT_R16G16_SFLOAT or VK_FORMAT_A2B10G10R10_SNORM_PACK32
+        AttributeDescription(uint32_t _location, uint32_t _componentCount, uint32_t _vertexCount, const float* _vertexData, VkFormat _format)
+            : location(_location)
+            , componentCount(_componentCount)
+            , vertexCount(_vertexCount)
+            , vertexData(_vertexData)
+            , format(_format)
+        {}
+
+        // data that already is in the component type of format, e.g. 8 bit colors for VK_FORMAT_R8G8B8A8_UNORM
+        AttributeDescription(uint32_t _location, uint32_t _componentCount, uint32_t _vertexCount, const void* _vertexData, vertexformat::SourceType _sourceType, VkFormat _format)
+            : location(_location)
+            , componentCount(_componentCount)
+            , vertexCount(_vertexCount)
+            , vertexData(_vertexData)
+            , sourceType(_sourceType)
+            , format(_format)
+        {}
+
         uint32_t location = 0;
         uint32_t componentCount = 0;
         uint32_t vertexCount = 0;
-        const float* vertexData = nullptr;
+        const void* vertexData = nullptr;
+        vertexformat::SourceType sourceType = vertexformat::SourceType::Float32;
+        // VK_FORMAT_UNDEFINED keeps 32 bit floats. A format with more components than the source is padded with 0.
+        VkFormat format = VK_FORMAT_UNDEFINED;
+    };
+
+    // Attribute of the binding that advances per instance, read from a struct at offset
+    struct InstanceAttributeDescription
+    {
+        uint32_t location = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t offset = 0;
     };
 
-    void init(Device* device, const std::vector<AttributeDescription>& descriptions);
+    // Without an upload batch the data is uploaded right away and the call blocks until the copy finished
+    void init(Device* device, const std::vector<AttributeDescription>& descriptions, UploadBatch* uploadBatch = nullptr, Layout layout = Layout::Planar);
     void destroy();
 
-    void setIndices(const uint16_t *indices, uint32_t numIndices);
-    void setIndices(const uint32_t *indices, uint32_t numIndices);
+    void setIndices(const uint16_t *indices, uint32_t numIndices, UploadBatch* uploadBatch = nullptr);
+    // Stored as 16 bit indices if all of them fit
+    void setIndices(const uint32_t *indices, uint32_t numIndices, UploadBatch* uploadBatch = nullptr);
+
+    // Adds a binding after the vertex bindings that advances once per instance, its instances are structs of stride bytes.
+    // Has to be called after init and before the pipeline is created.
+    void setInstanceLayout(uint32_t stride, const std::vector<InstanceAttributeDescription>& attributes);
+    // Instance data that stays the same, uploaded like the vertices and bound by bind
+    void setInstances(const void* instances, uint32_t instanceCount, UploadBatch* uploadBatch = nullptr);
+    // Binds instances written for this frame instead, e.g. a frame arena allocation
+    void bindInstances(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset) const;
 
-    void draw(VkCommandBuffer commandBuffer) const;
+    void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, uint32_t firstInstance = 0) const;
+    // Binds the vertex, instance and index buffers only, for drawing subranges with custom draw calls
+    void bind(VkCommandBuffer commandBuffer) const;
+
+    uint32_t getVertexCount() const { return m_numVertices; }
+    // Bytes per vertex over all attributes
+    uint32_t getVertexSize() const { return m_vertexSize; }
+    uint32_t getIndexCount() const { return m_numIndices; }
+    VkIndexType getIndexType() const { return m_indexType; }
+    uint32_t getInstanceCount() const { return m_numInstances; }
+    uint32_t getInstanceStride() const { return m_instanceBinding != NoInstanceBinding ? m_bindingDescriptions[m_instanceBinding].stride : 0; }
+    Layout getLayout() const { return m_layout; }
 
     const std::vector<VkVertexInputBindingDescription>& getBindingDescriptions() const;
     const std::vector<VkVertexInputAttributeDescription>& getAttributeDescriptions() const;
 
 private:
+    static const uint32_t NoInstanceBinding = ~0u;
+
     using MemcpyFunc = std::function<void(void*)>;
-    void createBuffer(VkBufferUsageFlags usage, uint32_t size, VkBuffer& buffer, VkDeviceMemory& bufferMemory, const MemcpyFunc& memcpyFunc);
-    void createIndexBuffer(const void *indices, uint32_t numIndices, VkIndexType indexType);
-    void mapMemory(VkDeviceMemory bufferMemory, const MemcpyFunc& memcpyFunc);
+    void initInterleaved(const std::vector<AttributeDescription>& descriptions, const std::vector<VkFormat>& formats, UploadBatch* uploadBatch);
+    VkFormat resolveFormat(const AttributeDescription& desc) const;
+    void createBuffer(VkBufferUsageFlags usage, uint32_t size, VkBuffer& buffer, MemoryAllocation& bufferMemory, const MemcpyFunc& memcpyFunc, UploadBatch* uploadBatch, const char* resource);
+    void createIndexBuffer(const void *indices, uint32_t numIndices, VkIndexType indexType, UploadBatch* uploadBatch);
 
     Device* m_device = nullptr;
     VkBuffer m_vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_vertexBufferMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_vertexBufferMemory;
 
     VkBuffer m_indexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_indexBufferMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_indexBufferMemory;
     VkIndexType m_indexType = VK_INDEX_TYPE_UINT16;
 
+    VkBuffer m_instanceBuffer = VK_NULL_HANDLE;
+    MemoryAllocation m_instanceBufferMemory;
+    uint32_t m_instanceBinding = NoInstanceBinding;
+    uint32_t m_numInstances = 0;
+
     uint32_t m_numVertices = 0;
     uint32_t m_numIndices = 0;
+    uint32_t m_vertexSize = 0;
+    Layout m_layout = Layout::Planar;
     std::vector<VkVertexInputAttributeDescription> m_attributesDescriptions;
     std::vector<VkVertexInputBindingDescription> m_bindingDescriptions;
+    // planar: every attribute is a tightly packed array in its own binding, starting at this offset in the vertex buffer.
+    // interleaved: a single binding at offset 0
+    // The instance binding, if any, comes after these and has no entry
+    std::vector<VkDeviceSize> m_bindingOffsets;
 };
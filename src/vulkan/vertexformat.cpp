@@ -0,0 +1,380 @@
+#include "vertexformat.h"
+#include "vulkanhelper.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VERTEXFORMAT_SSE2
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // same operand order as _mm_max_ps and _mm_min_ps, so NaN becomes the lower bound in both paths
+    float clamp(float value, float low, float high)
+    {
+        value = value > low ? value : low;
+        return value < high ? value : high;
+    }
+
+    // round to nearest even like cvtps2dq with the default rounding mode
+    int32_t roundToInt(float value)
+    {
+        return static_cast<int32_t>(std::nearbyint(value));
+    }
+
+    uint32_t floatBits(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    float bitsToFloat(uint32_t bits)
+    {
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Rounds the mantissa by adding half a half float ulp and lets the multiplication by 2^-112 rebias
+    // the exponent, which also produces denormals. Overflow becomes infinity, NaN stays a quiet NaN.
+    uint16_t toHalf(float value)
+    {
+        const uint32_t infinity = 255u << 23;
+        const uint32_t halfInfinity = 31u << 23;
+        const uint32_t magic = 15u << 23;
+        const uint32_t roundMask = ~0xfffu;
+
+        uint32_t bits = floatBits(value);
+        const uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+
+        uint32_t result;
+        if (bits >= infinity)
+        {
+            result = bits > infinity ? 0x7e00 : 0x7c00;
+        }
+        else
+        {
+            bits = floatBits(bitsToFloat(bits & roundMask) * bitsToFloat(magic)) - roundMask;
+            result = std::min(bits, halfInfinity) >> 13;
+        }
+
+        return static_cast<uint16_t>(result | (sign >> 16));
+    }
+
+    uint32_t packVertex(const float* v, bool snorm)
+    {
+        if (snorm)
+        {
+            return (static_cast<uint32_t>(roundToInt(clamp(v[0], -1.0f, 1.0f) * 511.0f)) & 0x3ff)
+                | ((static_cast<uint32_t>(roundToInt(clamp(v[1], -1.0f, 1.0f) * 511.0f)) & 0x3ff) << 10)
+                | ((static_cast<uint32_t>(roundToInt(clamp(v[2], -1.0f, 1.0f) * 511.0f)) & 0x3ff) << 20)
+                | ((static_cast<uint32_t>(roundToInt(clamp(v[3], -1.0f, 1.0f))) & 0x3) << 30);
+        }
+
+        return static_cast<uint32_t>(roundToInt(clamp(v[0], 0.0f, 1.0f) * 1023.0f))
+            | (static_cast<uint32_t>(roundToInt(clamp(v[1], 0.0f, 1.0f) * 1023.0f)) << 10)
+            | (static_cast<uint32_t>(roundToInt(clamp(v[2], 0.0f, 1.0f) * 1023.0f)) << 20)
+            | (static_cast<uint32_t>(roundToInt(clamp(v[3], 0.0f, 1.0f) * 3.0f)) << 30);
+    }
+
+#ifdef VERTEXFORMAT_SSE2
+    __m128i toHalf(__m128 value)
+    {
+        const __m128i infinity = _mm_set1_epi32(255 << 23);
+        const __m128 halfInfinity = _mm_castsi128_ps(_mm_set1_epi32(31 << 23));
+        const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(15 << 23));
+        const __m128 roundMask = _mm_castsi128_ps(_mm_set1_epi32(~0xfff));
+
+        const __m128 sign = _mm_and_ps(value, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+        const __m128 absolute = _mm_xor_ps(value, sign);
+        const __m128i absoluteBits = _mm_castps_si128(absolute);
+
+        const __m128i isNan = _mm_cmpgt_epi32(absoluteBits, infinity);
+        const __m128i isFinite = _mm_cmpgt_epi32(infinity, absoluteBits);
+        const __m128i special = _mm_or_si128(_mm_and_si128(isNan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+        // the clamp compares as float, for positive floats that orders like the integer bits
+        const __m128 scaled = _mm_mul_ps(_mm_and_ps(absolute, roundMask), magic);
+        const __m128i rebiased = _mm_sub_epi32(_mm_castps_si128(scaled), _mm_castps_si128(roundMask));
+        const __m128i clamped = _mm_castps_si128(_mm_min_ps(_mm_castsi128_ps(rebiased), halfInfinity));
+        const __m128i finite = _mm_and_si128(_mm_srli_epi32(clamped, 13), isFinite);
+
+        const __m128i result = _mm_or_si128(finite, _mm_andnot_si128(isFinite, special));
+        return _mm_or_si128(result, _mm_srli_epi32(_mm_castps_si128(sign), 16));
+    }
+
+    __m128i normalize(__m128 value, float low, float high, float scale)
+    {
+        value = _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(low)), _mm_set1_ps(high));
+        return _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(scale)));
+    }
+
+    // packs four 32 bit values that fit into 16 bits unsigned into the low 64 bits
+    __m128i packUnsigned16(__m128i value)
+    {
+        value = _mm_srai_epi32(_mm_slli_epi32(value, 16), 16);
+        return _mm_packs_epi32(value, value);
+    }
+#endif
+
+    template <typename T, typename Convert>
+    void convertScalar(const float* src, uint32_t begin, uint32_t count, T* dst, Convert convert)
+    {
+        for (uint32_t i = begin; i < count; ++i)
+        {
+            dst[i] = static_cast<T>(convert(src[i]));
+        }
+    }
+
+    // src holds info.componentCount floats per vertex, dst is tightly packed
+    void convertPacked(const float* src, uint32_t vertexCount, const vertexformat::FormatInfo& info, void* dst)
+    {
+        using namespace vertexformat;
+
+        const uint32_t count = vertexCount * info.componentCount;
+        switch (info.encoding)
+        {
+        case Encoding::Float32: memcpy(dst, src, count * sizeof(float)); break;
+        case Encoding::Float16: floatToHalf(src, count, static_cast<uint16_t*>(dst)); break;
+        case Encoding::Snorm16: floatToSnorm16(src, count, static_cast<int16_t*>(dst)); break;
+        case Encoding::Unorm16: floatToUnorm16(src, count, static_cast<uint16_t*>(dst)); break;
+        case Encoding::Snorm8: floatToSnorm8(src, count, static_cast<int8_t*>(dst)); break;
+        case Encoding::Unorm8: floatToUnorm8(src, count, static_cast<uint8_t*>(dst)); break;
+        case Encoding::Snorm10_10_10_2: packA2B10G10R10(src, vertexCount, true, static_cast<uint32_t*>(dst)); break;
+        case Encoding::Unorm10_10_10_2: packA2B10G10R10(src, vertexCount, false, static_cast<uint32_t*>(dst)); break;
+        default: assert(!"Unknown vertex format"); break;
+        }
+    }
+}
+
+vertexformat::FormatInfo vertexformat::getFormatInfo(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R32_SFLOAT: return { Encoding::Float32, 1, 4 };
+    case VK_FORMAT_R32G32_SFLOAT: return { Encoding::Float32, 2, 8 };
+    case VK_FORMAT_R32G32B32_SFLOAT: return { Encoding::Float32, 3, 12 };
+    case VK_FORMAT_R32G32B32A32_SFLOAT: return { Encoding::Float32, 4, 16 };
+    case VK_FORMAT_R16_SFLOAT: return { Encoding::Float16, 1, 2 };
+    case VK_FORMAT_R16G16_SFLOAT: return { Encoding::Float16, 2, 4 };
+    case VK_FORMAT_R16G16B16_SFLOAT: return { Encoding::Float16, 3, 6 };
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return { Encoding::Float16, 4, 8 };
+    case VK_FORMAT_R16_SNORM: return { Encoding::Snorm16, 1, 2 };
+    case VK_FORMAT_R16G16_SNORM: return { Encoding::Snorm16, 2, 4 };
+    case VK_FORMAT_R16G16B16_SNORM: return { Encoding::Snorm16, 3, 6 };
+    case VK_FORMAT_R16G16B16A16_SNORM: return { Encoding::Snorm16, 4, 8 };
+    case VK_FORMAT_R16_UNORM: return { Encoding::Unorm16, 1, 2 };
+    case VK_FORMAT_R16G16_UNORM: return { Encoding::Unorm16, 2, 4 };
+    case VK_FORMAT_R16G16B16_UNORM: return { Encoding::Unorm16, 3, 6 };
+    case VK_FORMAT_R16G16B16A16_UNORM: return { Encoding::Unorm16, 4, 8 };
+    case VK_FORMAT_R8_SNORM: return { Encoding::Snorm8, 1, 1 };
+    case VK_FORMAT_R8G8_SNORM: return { Encoding::Snorm8, 2, 2 };
+    case VK_FORMAT_R8G8B8_SNORM: return { Encoding::Snorm8, 3, 3 };
+    case VK_FORMAT_R8G8B8A8_SNORM: return { Encoding::Snorm8, 4, 4 };
+    case VK_FORMAT_R8_UNORM: return { Encoding::Unorm8, 1, 1 };
+    case VK_FORMAT_R8G8_UNORM: return { Encoding::Unorm8, 2, 2 };
+    case VK_FORMAT_R8G8B8_UNORM: return { Encoding::Unorm8, 3, 3 };
+    case VK_FORMAT_R8G8B8A8_UNORM: return { Encoding::Unorm8, 4, 4 };
+    case VK_FORMAT_A2B10G10R10_SNORM_PACK32: return { Encoding::Snorm10_10_10_2, 4, 4 };
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32: return { Encoding::Unorm10_10_10_2, 4, 4 };
+    default: return {};
+    }
+}
+
+VkFormat vertexformat::getFloatFormat(uint32_t componentCount)
+{
+    switch (componentCount)
+    {
+    case 1: return VK_FORMAT_R32_SFLOAT;
+    case 2: return VK_FORMAT_R32G32_SFLOAT;
+    case 3: return VK_FORMAT_R32G32B32_SFLOAT;
+    case 4: return VK_FORMAT_R32G32B32A32_SFLOAT;
+    default:
+        assert(!"Unknown number of components");
+        return VK_FORMAT_UNDEFINED;
+    }
+}
+
+uint32_t vertexformat::getComponentSize(SourceType type)
+{
+    switch (type)
+    {
+    case SourceType::Float32: return 4;
+    case SourceType::Float16:
+    case SourceType::Int16:
+    case SourceType::Uint16: return 2;
+    case SourceType::Int8:
+    case SourceType::Uint8: return 1;
+    }
+    return 0;
+}
+
+void vertexformat::convert(const float* src, uint32_t componentCount, uint32_t vertexCount, VkFormat format, void* dst, uint32_t dstStride)
+{
+    const FormatInfo info = getFormatInfo(format);
+    assert(info.encoding != Encoding::Unknown && componentCount <= info.componentCount && dstStride >= info.size);
+
+    if (componentCount == info.componentCount && dstStride == info.size)
+    {
+        convertPacked(src, vertexCount, info, dst);
+        return;
+    }
+
+    // missing components or a larger stride, expand and convert a chunk at a time on the stack
+    const uint32_t ChunkSize = 64;
+    float expanded[ChunkSize * 4];
+    uint8_t converted[ChunkSize * 16];
+
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    for (uint32_t begin = 0; begin < vertexCount; begin += ChunkSize)
+    {
+        const uint32_t count = std::min(ChunkSize, vertexCount - begin);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const float* vertex = src + (begin + i) * componentCount;
+            for (uint32_t c = 0; c < info.componentCount; ++c)
+            {
+                expanded[i * info.componentCount + c] = c < componentCount ? vertex[c] : 0.0f;
+            }
+        }
+
+        convertPacked(expanded, count, info, converted);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            memcpy(out, converted + i * info.size, info.size);
+            memset(out + info.size, 0, dstStride - info.size);
+            out += dstStride;
+        }
+    }
+}
+
+void vertexformat::copy(const void* src, SourceType type, uint32_t componentCount, uint32_t vertexCount, VkFormat format, void* dst, uint32_t dstStride)
+{
+    const FormatInfo info = getFormatInfo(format);
+    const uint32_t componentSize = getComponentSize(type);
+    const uint32_t size = componentSize * componentCount;
+    assert(info.componentCount >= componentCount && info.size == componentSize * info.componentCount && dstStride >= size);
+
+    if (size == dstStride)
+    {
+        memcpy(dst, src, static_cast<size_t>(size) * vertexCount);
+        return;
+    }
+
+    const uint8_t* in = static_cast<const uint8_t*>(src);
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    for (uint32_t i = 0; i < vertexCount; ++i)
+    {
+        memcpy(out, in, size);
+        memset(out + size, 0, dstStride - size);
+        in += size;
+        out += dstStride;
+    }
+}
+
+void vertexformat::floatToHalf(const float* src, uint32_t count, uint16_t* dst)
+{
+    uint32_t i = 0;
+#ifdef VERTEXFORMAT_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), packUnsigned16(toHalf(_mm_loadu_ps(src + i))));
+    }
+#endif
+    convertScalar(src, i, count, dst, [](float value) { return toHalf(value); });
+}
+
+void vertexformat::floatToSnorm16(const float* src, uint32_t count, int16_t* dst)
+{
+    uint32_t i = 0;
+#ifdef VERTEXFORMAT_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i value = normalize(_mm_loadu_ps(src + i), -1.0f, 1.0f, 32767.0f);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(value, value));
+    }
+#endif
+    convertScalar(src, i, count, dst, [](float value) { return roundToInt(clamp(value, -1.0f, 1.0f) * 32767.0f); });
+}
+
+void vertexformat::floatToUnorm16(const float* src, uint32_t count, uint16_t* dst)
+{
+    uint32_t i = 0;
+#ifdef VERTEXFORMAT_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i value = normalize(_mm_loadu_ps(src + i), 0.0f, 1.0f, 65535.0f);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), packUnsigned16(value));
+    }
+#endif
+    convertScalar(src, i, count, dst, [](float value) { return roundToInt(clamp(value, 0.0f, 1.0f) * 65535.0f); });
+}
+
+void vertexformat::floatToSnorm8(const float* src, uint32_t count, int8_t* dst)
+{
+    uint32_t i = 0;
+#ifdef VERTEXFORMAT_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i value = normalize(_mm_loadu_ps(src + i), -1.0f, 1.0f, 127.0f);
+        value = _mm_packs_epi32(value, value);
+        const int32_t packed = _mm_cvtsi128_si32(_mm_packs_epi16(value, value));
+        memcpy(dst + i, &packed, sizeof(packed));
+    }
+#endif
+    convertScalar(src, i, count, dst, [](float value) { return roundToInt(clamp(value, -1.0f, 1.0f) * 127.0f); });
+}
+
+void vertexformat::floatToUnorm8(const float* src, uint32_t count, uint8_t* dst)
+{
+    uint32_t i = 0;
+#ifdef VERTEXFORMAT_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i value = normalize(_mm_loadu_ps(src + i), 0.0f, 1.0f, 255.0f);
+        value = _mm_packs_epi32(value, value);
+        const int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(value, value));
+        memcpy(dst + i, &packed, sizeof(packed));
+    }
+#endif
+    convertScalar(src, i, count, dst, [](float value) { return roundToInt(clamp(value, 0.0f, 1.0f) * 255.0f); });
+}
+
+void vertexformat::packA2B10G10R10(const float* src, uint32_t vertexCount, bool snorm, uint32_t* dst)
+{
+    uint32_t i = 0;
+#ifdef VERTEXFORMAT_SSE2
+    const float low = snorm ? -1.0f : 0.0f;
+    const float scale = snorm ? 511.0f : 1023.0f;
+    const float scaleW = snorm ? 1.0f : 3.0f;
+    const __m128i mask10 = _mm_set1_epi32(0x3ff);
+    const __m128i mask2 = _mm_set1_epi32(0x3);
+
+    for (; i + 4 <= vertexCount; i += 4)
+    {
+        // four vertices of xyzw to one register per component
+        __m128 x = _mm_loadu_ps(src + i * 4);
+        __m128 y = _mm_loadu_ps(src + i * 4 + 4);
+        __m128 z = _mm_loadu_ps(src + i * 4 + 8);
+        __m128 w = _mm_loadu_ps(src + i * 4 + 12);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        const __m128i r = _mm_and_si128(normalize(x, low, 1.0f, scale), mask10);
+        const __m128i g = _mm_and_si128(normalize(y, low, 1.0f, scale), mask10);
+        const __m128i b = _mm_and_si128(normalize(z, low, 1.0f, scale), mask10);
+        const __m128i a = _mm_and_si128(normalize(w, low, 1.0f, scaleW), mask2);
+
+        const __m128i packed = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 10)), _mm_or_si128(_mm_slli_epi32(b, 20), _mm_slli_epi32(a, 30)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+    }
+#endif
+    for (; i < vertexCount; ++i)
+    {
+        dst[i] = packVertex(src + i * 4, snorm);
+    }
+}
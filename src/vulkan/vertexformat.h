@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+// Vertex attribute formats and the CPU kernels that convert float data into them.
+// Half floats, 16 and 8 bit normalized integers and packed 10_10_10_2 cut vertex memory and fetch
+// bandwidth to a half or a quarter of 32 bit floats. The kernels process four values at a time with SSE2.
+namespace vertexformat
+{
+    // Type of the components an application passes in. Float32 data is converted to any format,
+    // the other types are copied as they are and need a format with components of the same size.
+    enum class SourceType
+    {
+        Float32,
+        Float16,
+        Int16,
+        Uint16,
+        Int8,
+        Uint8
+    };
+
+    enum class Encoding
+    {
+        Unknown,
+        Float32,
+        Float16,
+        Snorm16,
+        Unorm16,
+        Snorm8,
+        Unorm8,
+        // x, y and z in 10 bits each, w in the top 2 bits
+        Snorm10_10_10_2,
+        Unorm10_10_10_2
+    };
+
+    struct FormatInfo
+    {
+        Encoding encoding = Encoding::Unknown;
+        uint32_t componentCount = 0;
+        // bytes per vertex
+        uint32_t size = 0;
+    };
+
+    FormatInfo getFormatInfo(VkFormat format);
+    // R32 to R32G32B32A32 SFLOAT
+    VkFormat getFloatFormat(uint32_t componentCount);
+    uint32_t getComponentSize(SourceType type);
+
+    // Converts vertexCount vertices of componentCount floats to format, written dstStride bytes apart.
+    // Values are clamped to the range of normalized formats and rounded to nearest.
+    // Components the format has but the source hasn't are 0.
+    void convert(const float* src, uint32_t componentCount, uint32_t vertexCount, VkFormat format, void* dst, uint32_t dstStride);
+    // Copies vertices of componentCount components of type to dst, padding up to the size of format with zeros
+    void copy(const void* src, SourceType type, uint32_t componentCount, uint32_t vertexCount, VkFormat format, void* dst, uint32_t dstStride);
+
+    // The kernels behind convert, on tightly packed arrays of count values
+    void floatToHalf(const float* src, uint32_t count, uint16_t* dst);
+    void floatToSnorm16(const float* src, uint32_t count, int16_t* dst);
+    void floatToUnorm16(const float* src, uint32_t count, uint16_t* dst);
+    void floatToSnorm8(const float* src, uint32_t count, int8_t* dst);
+    void floatToUnorm8(const float* src, uint32_t count, uint8_t* dst);
+    // src holds four floats per vertex, e.g. a normal and a sign in w
+    void packA2B10G10R10(const float* src, uint32_t vertexCount, bool snorm, uint32_t* dst);
+}